@@ -0,0 +1,238 @@
+// -*- C++ -*-
+// Copyright (C) Dmitry Igrishin
+// For conditions of distribution and use, see files LICENSE.txt
+
+#define PGSPA_NO_MAIN
+#include "pgspa.cpp"
+
+#include <chrono>
+#include <iomanip>
+#include <random>
+
+namespace dmitigr::pgspa::bench {
+
+/// @returns The general usage info.
+inline std::string usage()
+{
+  return std::string("pgspa_bench - The benchmark of pgspa\n\n")
+    .append("Usage: pgspa_bench generate [--files=<number>] [--statements=<number>]\n"
+            "                            [--shortcut_depth=<number>] [--dependency_depth=<number>]\n"
+            "                            [--misordering=<percent>] directory\n"
+            "       pgspa_bench run [pgspa exec options] [--runs=<number>] reference ...\n\n")
+    .append("The \"generate\" command generates the synthetic project in the directory.\n"
+            "The \"run\" command measures the reference resolution, the parsing and the\n"
+            "execution of the references of the project of the current working directory.\n"
+            "The execution is always rolled back.");
+}
+
+/// @returns The value of the numeric option `name` of `params`, or `default_value`.
+inline std::size_t numeric_option(const app::Program_parameters& params,
+  const std::string& name, const std::size_t default_value)
+{
+  if (const auto& o = params.option_with_argument(name))
+    return std::stoul(*o);
+  else
+    return default_value;
+}
+
+// =============================================================================
+
+/**
+ * @brief The "generate" command.
+ *
+ * Generates the project with the schema "bench" and the tables organized in
+ * chains of dependencies (by foreign keys) of the specified depth. The tables
+ * are spread over the files of the directory "bench". The specified
+ * percentage of the tables is deliberately misordered (placed before the
+ * tables they depend on). The directory "bench" is referenced through the
+ * chain of shortcuts "s0" -> "s1" -> ... of the specified depth.
+ */
+class Generate final : public Command {
+public:
+  explicit Generate(const app::Program_parameters& params)
+    : Command{params}
+  {
+    Util::check_options(params, {"files", "statements", "shortcut_depth",
+      "dependency_depth", "misordering"});
+    const auto& args = params.arguments();
+    if (args.size() != 1)
+      throw std::runtime_error{"exactly one directory must be specified"};
+    directory_ = args.front();
+    file_count_ = numeric_option(params, "files", 100);
+    statement_count_ = numeric_option(params, "statements", 10);
+    shortcut_depth_ = numeric_option(params, "shortcut_depth", 0);
+    dependency_depth_ = numeric_option(params, "dependency_depth", 1);
+    misordering_ = numeric_option(params, "misordering", 0);
+    if (!file_count_ || !statement_count_ || !dependency_depth_)
+      throw std::runtime_error{"the numbers of files, statements and the dependency depth must be positive"};
+    else if (misordering_ > 100)
+      throw std::runtime_error{"the misordering must be a percent"};
+  }
+
+  void run() override
+  {
+    if (filesystem::exists(directory_))
+      throw std::runtime_error{"the directory \"" + directory_.string() + "\" already exists"};
+    filesystem::create_directories(directory_ / root_marker);
+    filesystem::create_directory(directory_ / "bench");
+    write(directory_ / "bench.sql", "create schema bench;\n");
+
+    // The order of the creation of the tables.
+    const auto table_count = file_count_ * statement_count_;
+    std::vector<std::size_t> tables(table_count);
+    for (std::size_t t = 0; t < table_count; ++t)
+      tables[t] = t;
+    std::mt19937 generator; // deterministic
+    const auto misordered_count = table_count * misordering_ / 100 / 2;
+    for (std::size_t m = 0; m < misordered_count; ++m) {
+      std::uniform_int_distribution<std::size_t> distribution{0, table_count - 1};
+      std::swap(tables[distribution(generator)], tables[distribution(generator)]);
+    }
+
+    const auto width = std::to_string(file_count_ - 1).size();
+    for (std::size_t f = 0; f < file_count_; ++f) {
+      std::ostringstream name;
+      name << std::setw(width) << std::setfill('0') << f << ".sql";
+      std::string content;
+      for (std::size_t s = 0; s < statement_count_; ++s) {
+        const auto t = tables[f * statement_count_ + s];
+        content.append("create table bench.t").append(std::to_string(t)).append("(id integer primary key");
+        if (t % dependency_depth_)
+          content.append(", ref integer references bench.t").append(std::to_string(t - 1)).append("(id)");
+        content.append(");\n");
+      }
+      write(directory_ / "bench" / name.str(), content);
+    }
+
+    for (std::size_t d = 0; d < shortcut_depth_; ++d) {
+      const auto next = (d + 1 < shortcut_depth_) ? "s" + std::to_string(d + 1) : std::string{"bench"};
+      write(directory_ / ("s" + std::to_string(d)), next + "\n");
+    }
+
+    std::cout << "Generated project with " << table_count << " tables in " << file_count_
+              << " files (reference: \"" << (shortcut_depth_ ? "s0" : "bench") << "\")\n";
+  }
+
+private:
+  filesystem::path directory_;
+  std::size_t file_count_{};
+  std::size_t statement_count_{};
+  std::size_t shortcut_depth_{};
+  std::size_t dependency_depth_{};
+  std::size_t misordering_{};
+
+  static void write(const filesystem::path& path, const std::string& content)
+  {
+    std::ofstream stream{path, std::ios_base::trunc};
+    if (!(stream << content))
+      throw std::runtime_error{"cannot write \"" + path.string() + "\""};
+  }
+};
+
+// =============================================================================
+
+/// @brief The "run" command.
+class Run final : public Online {
+public:
+  explicit Run(const app::Program_parameters& params)
+    : Online{params}
+    , args_{params.arguments()}
+  {
+    Util::check_options(params, {"host", "address", "port", "database",
+      "username", "password", "client_encoding", "connect_timeout", "pipeline", "analysis", "runs"});
+    if (args_.empty())
+      throw std::runtime_error{"no references specified"};
+    if (const auto o = Util::boolean_option(params, "pipeline"))
+      options_.pipeline = *o;
+    if (const auto o = Util::boolean_option(params, "analysis"))
+      options_.analysis = *o;
+    options_.learned_order = false;
+    run_count_ = numeric_option(params, "runs", 3);
+    if (!run_count_)
+      throw std::runtime_error{"the number of runs must be positive"};
+  }
+
+  void run() override
+  {
+    using Clock = std::chrono::steady_clock;
+    const auto milliseconds = [](const Clock::duration d)
+    {
+      return std::chrono::duration<double, std::milli>{d}.count();
+    };
+
+    const auto root = Util::root_path();
+    std::vector<filesystem::path> references;
+    for (const auto& arg : args_)
+      references.push_back(root / arg);
+
+    auto* const cn = conn();
+    std::cout << "run resolution(ms) parsing(ms) execution(ms) files queries sweeps attempts failures\n";
+    for (std::size_t r = 0; r < run_count_; ++r) {
+      const auto t0 = Clock::now();
+      std::vector<filesystem::path> paths;
+      {
+        Project_tree tree{root};
+        for (const auto& arg_paths : tree.sql_paths(references))
+          paths.insert(cend(paths), cbegin(arg_paths), cend(arg_paths));
+      }
+
+      const auto t1 = Clock::now();
+      const auto batches = Sql_batch::make_many(paths);
+
+      const auto t2 = Clock::now();
+      Exec::Statistics stats;
+      std::size_t count{};
+      {
+        Tx_guard t{cn};
+        count = Exec::execute(cn, batches, options_, nullptr, nullptr, &stats);
+      } // rollback
+      const auto t3 = Clock::now();
+
+      std::cout << r + 1 << " " << std::fixed << std::setprecision(3)
+                << milliseconds(t1 - t0) << " " << milliseconds(t2 - t1) << " "
+                << milliseconds(t3 - t2) << " " << paths.size() << " " << count << " "
+                << stats.sweep_count << " " << stats.attempt_count << " "
+                << stats.failed_attempt_count << "\n";
+    }
+  }
+
+private:
+  std::vector<std::string> args_;
+  Exec::Options options_;
+  std::size_t run_count_{};
+};
+
+} // namespace dmitigr::pgspa::bench
+
+int main(const int argc, const char* const argv[])
+{
+  namespace app = dmitigr::app;
+  namespace pgfe = dmitigr::pgfe;
+  namespace spa = dmitigr::pgspa;
+  namespace bench = dmitigr::pgspa::bench;
+
+  if (argc <= 1) {
+    std::cerr << bench::usage() << "\n";
+    return 1;
+  }
+
+  const app::Program_parameters params{argc, argv};
+  const auto exe = params.executable_path().string();
+  try {
+    const auto& cmd = params.command_name();
+    if (cmd == "generate")
+      bench::Generate{params}.run();
+    else if (cmd == "run")
+      bench::Run{params}.run();
+    else
+      throw std::runtime_error{"unknown command \"" + cmd.value_or("") + "\""};
+  } catch (const spa::Handled_exception&) {
+    return 1;
+  } catch (const pgfe::Server_exception& e) {
+    std::cerr << exe << ": server error: " << e.error()->brief() << "\n";
+    return 1;
+  } catch (const std::exception& e) {
+    std::cerr << exe << ": " << e.what() << "\n";
+    return 1;
+  }
+}
@@ -14,14 +14,55 @@
 #include <dmitigr/pgfe.hpp>
 #include <dmitigr/str.hpp>
 
+#include <libpq-fe.h>
+
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <cctype>
+#include <chrono>
+#include <condition_variable>
+#include <csignal>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <fstream>
+#include <functional>
+#include <future>
+#include <iomanip>
 #include <iostream>
+#include <iterator>
+#include <limits>
+#include <list>
+#include <map>
 #include <memory>
+#include <mutex>
 #include <optional>
+#include <queue>
+#include <random>
+#include <set>
+#include <sstream>
 #include <stdexcept>
 #include <string>
+#include <string_view>
+#include <thread>
+#include <tuple>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
 
+#ifdef __linux__
+#include <poll.h>
+#include <sys/inotify.h>
+#endif
+
+#ifndef _WIN32
+#include <cstring>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#endif
+
 #define ASSERT DMITIGR_ASSERT
 #define ASSERT_ALWAYS DMITIGR_ASSERT_ALWAYS
 
@@ -39,11 +80,16 @@ inline std::string usage()
     .append("  version\n")
     .append("\n")
     .append("  init\n")
-    .append("  exec");
+    .append("  exec\n")
+    .append("  watch\n")
+    .append("  serve\n")
+    .append("  bundle");
 }
 
 const filesystem::path root_marker{".pgspa"};
 const filesystem::path per_directory_config{".pgspa_config"};
+const std::string parameter_prefix{"param."};
+const std::string jobs_lock_timeout{"10s"};
 
 /// @brief Utility functions.
 struct Util final {
@@ -57,144 +103,131 @@ struct Util final {
           "\" found in parent directory hierarchy"};
   }
 
-  /// @returns The vector of paths to SQL files of the specified `reference`.
-  static std::vector<filesystem::path> sql_paths(const filesystem::path& reference)
+  /// @brief Appends the `appendix` to the `result`.
+  static void push_back(std::vector<filesystem::path>& result,
+    const std::vector<filesystem::path>& appendix)
   {
-    return sql_paths(reference, {reference});
+    result.insert(cend(result), cbegin(appendix), cend(appendix));
   }
 
-  /// @returns The vector of paths to SQL files by the specified `reference`.
-  static std::vector<filesystem::path> sql_paths(const filesystem::path& reference,
-    std::vector<filesystem::path> trace)
+  /// @returns The per-directory configuration.
+  static cfg::Flat parsed_config(const filesystem::path& path)
   {
-    std::vector<filesystem::path> result;
-
-    if (const auto name = reference.filename(); name.empty() || name.string().front() == '.')
-      throw std::logic_error{"the reference name cannot be empty or starts with the dot (\".\")"};
-
-    static const auto sql_file_path = [](const filesystem::path& reference)
-    {
-      auto file = reference;
-      return file.replace_extension(".sql");
-    };
-
-    if (is_regular_file(reference) && reference.extension() == ".sql") {
-      result.push_back(reference);
-    } else if (is_regular_file(reference) && reference.extension().empty()) {
-      static const auto is_nor_empty_nor_commented = [](const std::string& line)
-      {
-        return (!line.empty() && line.front() != '#');
-      };
-      const auto parent = reference.parent_path();
-      const auto paths = str::file_to_strings_if(reference, is_nor_empty_nor_commented);
-
-      const auto is_in_trace = [&trace](const filesystem::path& p)
-      {
-        const auto b = cbegin(trace), e = cend(trace);
-        return std::find(b, e, p) != e;
-      };
-
-      for (const auto& path : paths) {
-        const auto full_path = parent / path;
-        if (!is_in_trace(full_path)) {
-          auto trace_copy = trace;
-          trace_copy.push_back(full_path);
-          push_back(result, sql_paths(full_path, std::move(trace_copy)));
-        } else {
-          std::string graph;
-          for (const auto& r : trace)
-            graph.append(r.string()).append(" -> ");
-          graph.append(full_path.string());
-          throw std::runtime_error{"reference cyclicity detected: \"" + graph + "\""};
-        }
-      }
-    } else if (is_directory(reference)) {
-      if (const auto config = reference / per_directory_config; is_regular_file(config)) {
-        if (auto params = parsed_config(config); params.boolean_parameter("explicit").value_or(false)) {
-          throw std::runtime_error{"the references of the directory \"" + reference.string() +
-              "\" are allowed to be used only explicitly"};
-        }
-      }
-
-      if (auto heading_file = sql_file_path(reference); is_regular_file(heading_file))
-        result.emplace_back(std::move(heading_file));
-
-      const auto refs_of_dir = [&reference]
-      {
-        auto result = refs_of_directory(reference);
-        std::sort(begin(result), end(result));
-        return result;
-      }();
-
-      for (auto r : refs_of_dir) {
-        r = reference / r;
-
-        r.replace_extension(".sql");
-        if (is_regular_file(r))
-          result.push_back(r);
-
-        r.replace_extension();
-        if (is_directory(r))
-          push_back(result, sql_paths(r, std::move(trace)));
-      }
-    } else if (auto file = sql_file_path(reference); is_regular_file(file)) {
-      result.emplace_back(std::move(file));
-    } else
-      throw std::runtime_error{"invalid reference \"" + reference.string() + "\" specified"};
+    cfg::Flat result{path};
+    for (const auto& pair : result.parameters()) {
+      if (pair.first != "explicit" && pair.first != "concurrent" &&
+        pair.first != "lock_timeout" && pair.first != "statement_timeout" &&
+        pair.first.compare(0, parameter_prefix.size(), parameter_prefix))
+        throw std::logic_error{"unknown parameter \"" + pair.first +
+            "\" specified in \"" + path.string() + "\""};
+    }
     return result;
   }
 
-  /// @brief Appends the `appendix` to the `result`.
-  static void push_back(std::vector<filesystem::path>& result,
-    std::vector<filesystem::path>&& appendix)
+  /// @returns The generic path of `path` relative to the project `root`.
+  static std::string project_path(const filesystem::path& path, const filesystem::path& root)
   {
-    result.insert(cend(result), std::move_iterator(begin(appendix)),
-      std::move_iterator(end(appendix)));
+    return path.lexically_relative(root).generic_string();
   }
 
-  /// @brief Appends `path` to `result` if it's not already there.
-  static void push_back_if_not_exists(std::vector<filesystem::path>& result,
-    filesystem::path path)
+  /// @returns The hexadecimal representation of `value`.
+  static std::string hex(const std::uint64_t value)
   {
-    if (std::none_of(cbegin(result), cend(result),
-        [&](const auto& elem) { return elem == path; }))
-      result.push_back(std::move(path));
+    std::ostringstream result;
+    result << std::hex << value;
+    return result.str();
   }
 
-  /// @brief Appends `e` to `result` if `e` represents the SQL file or the directory.
-  static void push_back_if_sql_file_or_directory(std::vector<filesystem::path>& result,
-    const filesystem::directory_entry& e)
+  /// @returns The JSON string literal of `value`.
+  static std::string to_json_string(const std::string_view value)
   {
-    const auto& path = e.path();
-    if (is_regular_file(path) && path.extension() == ".sql")
-      push_back_if_not_exists(result, path.stem());
-    else if (is_directory(path))
-      push_back_if_not_exists(result, path.filename());
+    std::string result{"\""};
+    result.reserve(value.size() + 2);
+    for (const char c : value) {
+      switch (c) {
+      case '"': result.append("\\\""); break;
+      case '\\': result.append("\\\\"); break;
+      case '\n': result.append("\\n"); break;
+      case '\r': result.append("\\r"); break;
+      case '\t': result.append("\\t"); break;
+      default:
+        if (static_cast<unsigned char>(c) < 0x20) {
+          static const char digits[] = "0123456789abcdef";
+          result.append("\\u00").append(1, digits[c >> 4]).append(1, digits[c & 0xf]);
+        } else
+          result.append(1, c);
+      }
+    }
+    result.append("\"");
+    return result;
   }
 
-  /// @returns The vector of database object names from the specified `path`.
-  static std::vector<filesystem::path> refs_of_directory(const filesystem::path& path)
+  /**
+   * @returns The 64-bit FNV-1a hash of `data` (which is stable across runs).
+   * The `seed` can be the hash of the preceding data to hash the data by parts.
+   */
+  static std::uint64_t hash(const std::string_view data,
+    const std::uint64_t seed = 14695981039346656037ULL)
   {
-    if (!is_directory(path))
-      throw std::runtime_error{"directory \"" + path.string() + "\" does not exists"};
-    std::vector<filesystem::path> result;
-    for (const auto& e : filesystem::directory_iterator{path})
-      push_back_if_sql_file_or_directory(result, e);
+    std::uint64_t result{seed};
+    for (const unsigned char c : data) {
+      result ^= c;
+      result *= 1099511628211ULL;
+    }
     return result;
   }
 
-  /// @returns The per-directory configuration.
-  static cfg::Flat parsed_config(const filesystem::path& path)
+  /**
+   * @returns The hash of the content of the file at `path` (without loading
+   * it entirely). The `seed` is the same as of `hash()`.
+   */
+  static std::uint64_t file_hash(const filesystem::path& path,
+    const std::uint64_t seed = hash({}))
   {
-    cfg::Flat result{path};
-    for (const auto& pair : result.parameters()) {
-      if (pair.first != "explicit")
-        throw std::logic_error{"unknown parameter \"" + pair.first +
-            "\" specified in \"" + path.string() + "\""};
-    }
+    auto result = seed;
+    read_file(path, [&result](const std::string_view chunk)
+    {
+      result = hash(chunk, result);
+    });
     return result;
   }
 
+  /**
+   * @brief Reads the file at `path` by chunks (without loading it entirely),
+   * and passes each chunk to `consume(std::string_view)`.
+   */
+  template<typename F>
+  static void read_file(const filesystem::path& path, F&& consume)
+  {
+    std::ifstream stream{path, std::ios_base::binary};
+    if (!stream)
+      throw std::runtime_error{"cannot open file \"" + path.string() + "\""};
+    std::string buffer(64 * 1024, '\0');
+    while (stream.read(buffer.data(), buffer.size()) || stream.gcount())
+      consume(std::string_view{buffer.data(), static_cast<std::size_t>(stream.gcount())});
+  }
+
+  /**
+   * @returns The value of the boolean option `name` of `params`, or
+   * `std::nullopt` if there is no such an option.
+   *
+   * @throws `std::runtime_error` if the value is neither "yes" nor "no".
+   */
+  static std::optional<bool> boolean_option(const app::Program_parameters& params,
+    const std::string& name)
+  {
+    if (const auto o = params.option_with_argument(name)) {
+      if (*o == "yes")
+        return true;
+      else if (*o == "no")
+        return false;
+      else
+        throw std::runtime_error{"invalid value of option " + name +
+            " (must be \"yes\" or \"no\")"};
+    } else
+      return std::nullopt;
+  }
+
   /**
    * @brief Throws `std::runtime_error` if there are an option in `params`
    * which is not in `opts`.
@@ -208,515 +241,6502 @@ struct Util final {
 
 // ===========================================================================
 
-/// @brief A batch of SQL commands of a file.
-class Sql_batch final {
+/**
+ * @brief A walker of the project tree.
+ *
+ * Each directory is listed in a single pass by using the file types cached in
+ * the directory entries. The listings and the per-directory configurations are
+ * cached, so each directory is listed (and its configuration is parsed) at most
+ * once. The listings can be persisted to the index file, which is validated by
+ * the modification times of the directories and of the configuration files, so
+ * the repeated runs do not list the unchanged directories at all.
+ */
+class Project_tree final {
 public:
-  explicit Sql_batch(const filesystem::path& path)
-    : path_{path}
+  /**
+   * @brief The constructor.
+   *
+   * @param root The root path of the project.
+   * @param index The path to the index file to use.
+   */
+  explicit Project_tree(filesystem::path root, std::optional<filesystem::path> index = {})
+    : root_{std::move(root)}
+    , index_{std::move(index)}
   {
-    vec_ = pgfe::Sql_vector::make(str::file_to_string(*path_));
-    ASSERT_ALWAYS(is_valid());
+    if (index_)
+      load_index();
   }
 
-  explicit Sql_batch(std::unique_ptr<pgfe::Sql_vector>&& vec)
-    : vec_{std::move(vec)}
+  /// @returns The vector of paths to SQL files of the specified `reference`.
+  const std::vector<filesystem::path>& sql_paths(const filesystem::path& reference)
   {
-    ASSERT_ALWAYS(is_valid());
+    return resolved(normal(reference));
   }
 
-  static std::vector<Sql_batch> make_many(const std::vector<filesystem::path>& paths)
+  /**
+   * @returns The vectors of paths to SQL files of the specified `references`.
+   * Each SQL file is included only once: at the position of its first
+   * occurrence.
+   */
+  std::vector<std::vector<filesystem::path>> sql_paths(const std::vector<filesystem::path>& references)
   {
-    std::vector<Sql_batch> result;
-    result.reserve(paths.size());
-    for (const auto& path : paths)
-      result.emplace_back(path);
+    std::vector<std::vector<filesystem::path>> result;
+    result.reserve(references.size());
+    std::unordered_set<std::string> seen;
+    for (const auto& reference : references) {
+      const auto& paths = sql_paths(reference);
+      auto& unique_paths = result.emplace_back();
+      unique_paths.reserve(paths.size());
+      for (const auto& path : paths) {
+        if (seen.insert(path.string()).second)
+          unique_paths.push_back(path);
+      }
+    }
     return result;
   }
 
-  const std::optional<filesystem::path>& path() const
+  /**
+   * @returns `true` if the `reference` is allowed to be executed concurrently
+   * with the other references, i.e. if the directory of the reference (or the
+   * reference itself if it's a directory) is marked with `concurrent` parameter.
+   */
+  bool is_concurrent(const filesystem::path& reference)
   {
-    return path_;
+    const auto normal_reference = normal(reference);
+    const auto& parent = directory(normal_reference.parent_path());
+    if (parent.directories.count(normal_reference.filename().string()))
+      return directory(normal_reference).is_concurrent;
+    else
+      return parent.is_concurrent;
   }
 
-  const pgfe::Sql_vector* sql_vector() const
+  /// @brief Saves the index (if any) to the file if it was modified.
+  void save_index() const
   {
-    return vec_.get();
-  }
+    if (!index_ || !is_index_modified_)
+      return;
 
-private:
-  bool is_valid() const
-  {
-    const bool vec_ok = static_cast<bool>(vec_);
-    return vec_ok;
+    auto tmp = *index_;
+    tmp += ".tmp";
+    {
+      std::ofstream stream{tmp, std::ios_base::trunc};
+      if (!stream)
+        throw std::runtime_error{"cannot open file \"" + tmp.string() + "\" for writing"};
+
+      /*
+       * Format:
+       * D <mtime> <config mtime or -> <explicit> <concurrent> <path relative to the root>
+       * S <name of SQL file without extension>
+       * R <name of subdirectory>
+       * H <name of shortcut>
+       */
+      for (const auto& [path, d] : directories_) {
+        stream << "D " << d.mtime.time_since_epoch().count() << ' ';
+        if (d.config_mtime)
+          stream << d.config_mtime->time_since_epoch().count();
+        else
+          stream << '-';
+        stream << ' ' << d.is_explicit << ' ' << d.is_concurrent << ' '
+               << Util::project_path(path, root_) << '\n';
+        for (const auto& name : d.sql_files)
+          stream << "S " << name << '\n';
+        for (const auto& name : d.directories)
+          stream << "R " << name << '\n';
+        for (const auto& name : d.shortcuts)
+          stream << "H " << name << '\n';
+      }
+    }
+    filesystem::rename(tmp, *index_);
   }
 
-  std::unique_ptr<pgfe::Sql_vector> vec_;
-  std::optional<filesystem::path> path_;
-};
+private:
+  /// @brief The listing of a directory.
+  struct Directory final {
+    filesystem::file_time_type mtime;
+    std::optional<filesystem::file_time_type> config_mtime;
+    bool is_explicit{};
+    bool is_concurrent{};
+    std::unordered_set<std::string> sql_files; // names without extension
+    std::unordered_set<std::string> directories;
+    std::unordered_set<std::string> shortcuts;
+    bool is_validated{};
+
+    /// @returns The sorted names of the SQL files (without extension) and subdirectories.
+    std::vector<std::string> refs() const
+    {
+      std::vector<std::string> result(cbegin(sql_files), cend(sql_files));
+      for (const auto& name : directories) {
+        if (!sql_files.count(name))
+          result.push_back(name);
+      }
+      std::sort(begin(result), end(result));
+      return result;
+    }
+  };
 
-// ===========================================================================
+  filesystem::path root_;
+  std::optional<filesystem::path> index_;
+  std::map<filesystem::path, Directory> directories_;
+  bool is_index_modified_{};
 
-/// @brief A transaction guard.
-class Tx_guard final {
-public:
-  Tx_guard(const Tx_guard&) = delete;
-  Tx_guard& operator=(const Tx_guard&) = delete;
-  Tx_guard(Tx_guard&&) = delete;
-  Tx_guard& operator=(Tx_guard&&) = delete;
+  // The graph of the resolved references.
+  std::map<filesystem::path, std::vector<filesystem::path>> resolved_;
+  // The references being resolved (to detect cycles).
+  std::unordered_set<std::string> active_;
+  std::vector<filesystem::path> trace_;
 
-  static void begin(pgfe::Connection* const conn)
+  /// @returns The lexically normal `path` without the trailing separator.
+  static filesystem::path normal(const filesystem::path& path)
   {
-    ASSERT_ALWAYS(conn);
-    if (!conn->is_transaction_block_uncommitted())
-      conn->perform("begin");
+    auto result = path.lexically_normal();
+    if (result.has_relative_path() && !result.has_filename())
+      result = result.parent_path();
+    return result;
   }
 
-  static void commit(pgfe::Connection* const conn)
+  /**
+   * @returns The vector of paths to SQL files by the specified (normal)
+   * `reference`. The results are memoized.
+   *
+   * @throws `std::runtime_error` if the cyclic reference is detected.
+   */
+  const std::vector<filesystem::path>& resolved(const filesystem::path& reference)
   {
-    ASSERT_ALWAYS(conn);
-    if (conn->is_transaction_block_uncommitted())
-      conn->perform("commit");
+    if (const auto i = resolved_.find(reference); i != cend(resolved_))
+      return i->second;
+
+    if (!active_.insert(reference.string()).second) {
+      std::string graph;
+      const auto b = std::find(cbegin(trace_), cend(trace_), reference);
+      for (auto i = b; i != cend(trace_); ++i)
+        graph.append(i->string()).append(" -> ");
+      graph.append(reference.string());
+      throw std::runtime_error{"reference cyclicity detected: \"" + graph + "\""};
+    }
+
+    struct Trace_guard final {
+      Project_tree& tree;
+      ~Trace_guard()
+      {
+        tree.active_.erase(tree.trace_.back().string());
+        tree.trace_.pop_back();
+      }
+    };
+    trace_.push_back(reference);
+    const Trace_guard guard{*this};
+    auto result = resolve(reference);
+    return resolved_[reference] = std::move(result);
   }
 
-  static void rollback(pgfe::Connection* const conn)
+  /// @returns The vector of paths to SQL files by the specified (normal) `reference`.
+  std::vector<filesystem::path> resolve(const filesystem::path& reference)
   {
-    ASSERT_ALWAYS(conn);
-    if (conn->is_transaction_block_uncommitted())
-      conn->perform("rollback");
+    std::vector<filesystem::path> result;
+
+    const auto name = reference.filename().string();
+    if (name.empty() || name.front() == '.')
+      throw std::logic_error{"the reference name cannot be empty or starts with the dot (\".\")"};
+
+    static const auto sql_file_path = [](const filesystem::path& reference)
+    {
+      auto file = reference;
+      return file.replace_extension(".sql");
+    };
+
+    const auto parent = reference.parent_path();
+    const auto* const parent_dir = find_directory(parent);
+    const auto extension = reference.extension();
+    const auto stem = reference.stem().string();
+    if (!parent_dir) {
+      throw std::runtime_error{"invalid reference \"" + reference.string() + "\" specified"};
+    } else if (extension == ".sql" && parent_dir->sql_files.count(stem)) {
+      result.push_back(reference);
+    } else if (extension.empty() && parent_dir->shortcuts.count(name)) {
+      static const auto is_nor_empty_nor_commented = [](const std::string& line)
+      {
+        return (!line.empty() && line.front() != '#');
+      };
+      for (const auto& path : str::file_to_strings_if(reference, is_nor_empty_nor_commented))
+        Util::push_back(result, resolved(normal(parent / path)));
+    } else if (parent_dir->directories.count(name)) {
+      const auto heading_file_exists = parent_dir->sql_files.count(name) > 0;
+      const auto& dir = directory(reference);
+      if (dir.is_explicit) {
+        throw std::runtime_error{"the references of the directory \"" + reference.string() +
+            "\" are allowed to be used only explicitly"};
+      }
+
+      if (heading_file_exists)
+        result.push_back(sql_file_path(reference));
+
+      for (const auto& r : dir.refs()) {
+        if (dir.directories.count(r))
+          Util::push_back(result, resolved(reference / r)); // with heading file (if any)
+        else
+          result.push_back(reference / (r + ".sql"));
+      }
+    } else if (parent_dir->sql_files.count(stem)) {
+      result.push_back(sql_file_path(reference));
+    } else
+      throw std::runtime_error{"invalid reference \"" + reference.string() + "\" specified"};
+    return result;
   }
 
-  ~Tx_guard()
+  /**
+   * @returns The listing of the directory `path`.
+   *
+   * @throws `std::runtime_error` if there is no such a directory.
+   */
+  const Directory& directory(const filesystem::path& path)
   {
-    // No care about exceptions here: let it crash.
-    rollback(conn_);
+    if (const auto* const result = find_directory(path))
+      return *result;
+    else
+      throw std::runtime_error{"directory \"" + path.string() + "\" does not exists"};
   }
 
-  Tx_guard(pgfe::Connection* const conn)
-    : conn_{conn}
+  /// @returns The listing of the directory `path`, or `nullptr` if there is no such a directory.
+  const Directory* find_directory(const filesystem::path& path)
   {
-    ASSERT_ALWAYS(conn_);
-    begin(conn_);
+    const auto key = path.empty() ? filesystem::path{"."} : path;
+    if (const auto i = directories_.find(key); i != end(directories_)) {
+      auto& d = i->second;
+      if (d.is_validated)
+        return &d;
+
+      // Validate the listing loaded from the index.
+      std::error_code ec;
+      const auto mtime = filesystem::last_write_time(key, ec);
+      if (!ec && mtime == d.mtime) {
+        if (!d.config_mtime || filesystem::last_write_time(key / per_directory_config, ec) == *d.config_mtime) {
+          if (!ec) {
+            d.is_validated = true;
+            return &d;
+          }
+        }
+      }
+      directories_.erase(i);
+    }
+
+    std::error_code ec;
+    if (!filesystem::is_directory(key, ec))
+      return nullptr;
+
+    Directory d;
+    d.mtime = filesystem::last_write_time(key);
+    for (const auto& e : filesystem::directory_iterator{key}) {
+      const auto& path = e.path();
+      const auto name = path.filename().string();
+      if (name == per_directory_config.string()) {
+        d.config_mtime = e.last_write_time();
+        const auto config = Util::parsed_config(path);
+        d.is_explicit = config.boolean_parameter("explicit").value_or(false);
+        d.is_concurrent = config.boolean_parameter("concurrent").value_or(false);
+      } else if (name.empty() || name.front() == '.') {
+        continue; // cannot be a reference
+      } else if (e.is_directory()) {
+        d.directories.insert(name);
+      } else if (e.is_regular_file()) {
+        if (const auto extension = path.extension(); extension == ".sql")
+          d.sql_files.insert(path.stem().string());
+        else if (extension.empty())
+          d.shortcuts.insert(name);
+      }
+    }
+    d.is_validated = true;
+    is_index_modified_ = true;
+    return &(directories_[key] = std::move(d));
   }
 
-  void commit()
+  /// @brief Loads the index from the file (the loaded listings are validated lazily).
+  void load_index()
   {
-    commit(conn_);
-  }
+    ASSERT(index_);
+    std::ifstream stream{*index_};
+    std::string line;
+    Directory* d{};
+    while (std::getline(stream, line)) {
+      if (line.size() < 3 || line[1] != ' ') {
+        d = nullptr;
+        continue; // just ignore the malformed line
+      }
 
-private:
-  pgfe::Connection* conn_;
+      const auto value = line.substr(2);
+      if (line.front() == 'D') {
+        std::istringstream s{value};
+        long long mtime{};
+        std::string config_mtime;
+        bool is_explicit{}, is_concurrent{};
+        std::string path;
+        if (s >> mtime >> config_mtime >> is_explicit >> is_concurrent && s.get() == ' ' &&
+          std::getline(s, path) && !path.empty()) {
+          Directory& dir = directories_[normal(root_ / path)];
+          dir = {};
+          dir.mtime = filesystem::file_time_type{filesystem::file_time_type::duration{mtime}};
+          if (config_mtime != "-") {
+            try {
+              dir.config_mtime = filesystem::file_time_type{
+                filesystem::file_time_type::duration{std::stoll(config_mtime)}};
+            } catch (const std::logic_error&) {
+              dir.mtime = {}; // invalidate
+            }
+          }
+          dir.is_explicit = is_explicit;
+          dir.is_concurrent = is_concurrent;
+          d = &dir;
+        } else
+          d = nullptr;
+      } else if (d && line.front() == 'S') {
+        d->sql_files.insert(value);
+      } else if (d && line.front() == 'R') {
+        d->directories.insert(value);
+      } else if (d && line.front() == 'H') {
+        d->shortcuts.insert(value);
+      }
+    }
+  }
 };
 
+// ===========================================================================
+
 /**
- * @brief A dummy exception to throw after handling of a real exception.
+ * @brief An index of the offsets of the lines of a text.
  *
- * @remarks The exception handlers of this type shouldn't have side effects.
+ * The index is built once per text, so the line and column numbers of any
+ * position are found by the binary search rather than by the scan of the text.
  */
-class Handled_exception final {};
-
-/// @brief A pgspa command.
-class Command {
+class Line_index final {
 public:
-  /// @returns A new instance from the textual type identifier.
-  template<typename ... Types>
-  static std::unique_ptr<Command> make(const std::string_view name, Types&& ... params);
-
-  /// @overload
-  static std::unique_ptr<Command> make(const app::Program_parameters& params);
-
-  /// @returns The name of the command.
-  virtual const std::string& name() const
+  /// @brief The constructor.
+  explicit Line_index(const std::string_view text)
   {
-    return name_;
+    offsets_.push_back(0);
+    for (auto p = text.find('\n'); p != std::string_view::npos; p = text.find('\n', p + 1))
+      offsets_.push_back(p + 1);
   }
 
-  /// @returns `true` if the invariant is okay, or `false` otherwise.
-  virtual bool is_valid() const
+  /// @returns The zero-based line and column numbers of the `position`.
+  std::pair<std::size_t, std::size_t> line_column_numbers(const std::size_t position) const
   {
-    return !name_.empty();
+    const auto i = std::upper_bound(cbegin(offsets_), cend(offsets_), position) - cbegin(offsets_) - 1;
+    return {i, position - offsets_[i]};
   }
 
-  /// @brief Runs the current command.
-  virtual void run() = 0;
-
-protected:
-  /// @brief The constructor.
-  Command(std::string name = {})
-    : name_{std::move(name)}
-  {}
-
-  /// @overload
-  explicit Command(const app::Program_parameters& params)
-    : name_{params.command_name().value()}
-  {}
-
 private:
-  std::string name_;
+  std::vector<std::size_t> offsets_;
 };
 
-// =============================================================================
+// ===========================================================================
 
-/// @brief The "help" command.
-class Help final : public Command {
+/**
+ * @brief A lexer of a SQL query, which splits it into the lexemes.
+ *
+ * The lexer only recognizes the lexemes which affect the interpretation of
+ * the rest of the query: the comments, literals, quoted identifiers and
+ * dollar-quoted strings (so nothing inside them is mistaken for anything
+ * else), the words, the numbers, the parameters (`$1`) and the references
+ * to the variables quoted like in `psql` (`:'name'` and `:"name"`).
+ */
+class Sql_lexer final {
 public:
-  Help()
-    : Command("help")
+  /// @brief A lexeme.
+  struct Lexeme final {
+    enum class Kind {
+      space,
+      comment,
+      literal, // including the escape string constants like E'\n'
+      quoted_identifier,
+      dollar_quoted,
+      word, // a keyword or an unquoted identifier
+      number,
+      parameter, // like $1
+      variable, // like :'name' or :"name"
+      punctuation // a character, or "::"
+    };
+
+    Kind kind{Kind::space};
+    std::string_view text;
+
+    /// @returns The content of the dollar-quoted string (without the delimiters).
+    std::string_view dollar_quoted_content() const
+    {
+      ASSERT(kind == Kind::dollar_quoted);
+      const auto tag_size = text.find('$', 1) + 1;
+      const bool is_closed = text.size() >= 2 * tag_size &&
+        text.substr(text.size() - tag_size) == text.substr(0, tag_size);
+      return text.substr(tag_size, text.size() - tag_size - (is_closed ? tag_size : 0));
+    }
+
+    /// @returns The name of the variable.
+    std::string_view variable_name() const
+    {
+      ASSERT(kind == Kind::variable);
+      return text.substr(2, text.size() - 3);
+    }
+  };
+
+  /// @brief The constructor.
+  explicit Sql_lexer(const std::string_view query)
+    : query_{query}
   {}
 
-  explicit Help(const app::Program_parameters& params)
-    : Command{params}
+  /// @returns The next lexeme, or `std::nullopt` at the end of the query.
+  std::optional<Lexeme> next()
   {
-    const auto& args = params.arguments();
-    usage_ = (args.size() != 1) ? usage("help") : usage(args.back());
-  }
+    using Kind = Lexeme::Kind;
+    const auto size = query_.size();
+    if (position_ >= size)
+      return std::nullopt;
+
+    const auto start = position_;
+    const char c = query_[position_];
+    const auto is_at = [this](const std::size_t p, const std::string_view str)
+    {
+      return query_.substr(p, str.size()) == str;
+    };
+    const auto skip_quoted = [&](const char quote, const bool is_escape)
+    {
+      for (++position_; position_ < size; ++position_) {
+        if (is_escape && query_[position_] == '\\')
+          ++position_;
+        else if (query_[position_] == quote) {
+          if (position_ + 1 < size && query_[position_ + 1] == quote)
+            ++position_;
+          else
+            break;
+        }
+      }
+      position_ = std::min(position_ + 1, size);
+    };
+    const auto lexeme = [&](const Kind kind)
+    {
+      return Lexeme{kind, query_.substr(start, position_ - start)};
+    };
 
-  void run() override
-  {
-    std::cout << usage_;
-    std::cout.flush();
+    if (std::isspace(static_cast<unsigned char>(c))) {
+      while (position_ < size && std::isspace(static_cast<unsigned char>(query_[position_])))
+        ++position_;
+      return lexeme(Kind::space);
+    } else if (is_at(position_, "--")) {
+      position_ = std::min(query_.find('\n', position_), size);
+      return lexeme(Kind::comment);
+    } else if (is_at(position_, "/*")) {
+      std::size_t depth{1};
+      for (position_ += 2; position_ < size && depth; ++position_) {
+        if (is_at(position_, "*/"))
+          --depth, ++position_;
+        else if (is_at(position_, "/*"))
+          ++depth, ++position_;
+      }
+      position_ = std::min(position_, size);
+      return lexeme(Kind::comment);
+    } else if (c == '\'') {
+      skip_quoted('\'', false);
+      return lexeme(Kind::literal);
+    } else if (c == '"') {
+      skip_quoted('"', false);
+      return lexeme(Kind::quoted_identifier);
+    } else if (c == '$') {
+      auto e = position_ + 1;
+      if (e < size && std::isdigit(static_cast<unsigned char>(query_[e]))) {
+        while (e < size && std::isdigit(static_cast<unsigned char>(query_[e])))
+          ++e;
+        position_ = e;
+        return lexeme(Kind::parameter);
+      }
+      while (e < size && is_word_char(query_[e]) && query_[e] != '$')
+        ++e;
+      if (e < size && query_[e] == '$') {
+        const auto tag = query_.substr(position_, e - position_ + 1);
+        const auto end = query_.find(tag, e + 1);
+        position_ = end == std::string_view::npos ? size : end + tag.size();
+        return lexeme(Kind::dollar_quoted);
+      }
+      ++position_;
+      return lexeme(Kind::punctuation);
+    } else if (is_word_start(c)) {
+      if ((c == 'e' || c == 'E') && position_ + 1 < size && query_[position_ + 1] == '\'') {
+        ++position_;
+        skip_quoted('\'', true);
+        return lexeme(Kind::literal);
+      }
+      while (position_ < size && is_word_char(query_[position_]))
+        ++position_;
+      return lexeme(Kind::word);
+    } else if (std::isdigit(static_cast<unsigned char>(c))) {
+      while (position_ < size && (std::isalnum(static_cast<unsigned char>(query_[position_])) ||
+          query_[position_] == '_'))
+        ++position_;
+      return lexeme(Kind::number);
+    } else if (c == ':') {
+      if (is_at(position_ + 1, ":")) {
+        position_ += 2;
+        return lexeme(Kind::punctuation);
+      } else if (position_ + 1 < size && (query_[position_ + 1] == '\'' || query_[position_ + 1] == '"')) {
+        const char quote = query_[position_ + 1];
+        auto e = position_ + 2;
+        while (e < size && (std::isalnum(static_cast<unsigned char>(query_[e])) || query_[e] == '_'))
+          ++e;
+        if (e > position_ + 2 && e < size && query_[e] == quote) {
+          position_ = e + 1;
+          return lexeme(Kind::variable);
+        }
+      }
+    }
+    ++position_;
+    return lexeme(Kind::punctuation);
   }
 
 private:
-  std::string usage_;
-
-  /// @returns The string with the options specific to the `cmd` command.
-  static std::string options(const std::string_view cmd)
-  {
-    ASSERT_ALWAYS(!cmd.empty());
-    if (cmd == "exec")
-      return std::string{
-        "  --host=<name> - the hostname of the PostgreSQL server (\"localhost\" by default).\n"
-        "  --address=<IP address> - the IP address of the PostgreSQL server to connect to (\"127.0.0.1\" by default).\n"
-        "  --port=<number> - the port number of the PostgreSQL server to operate (\"5432\" by default).\n"
-        "  --username=<name> - the name of the user to operate (current username by default).\n"
-        "  --password=<password> - the password (be aware, it may appear in the system logs!)\n"
-        "  --database=<name> - the name of the database to operate (value of --username by default).\n"
-        "  --client_encoding=<name> - the name of the client encoding to operate.\n"
-        "  --connect_timeout=<seconds> - the connect timeout in seconds (\"8\" by default)."};
-    else
-      return {};
-  }
+  std::string_view query_;
+  std::size_t position_{};
 
-  /// @returns The string with the arguments specific to the `cmd` command.
-  static std::string arguments(const std::string_view cmd)
+  static bool is_word_start(const char c)
   {
-    ASSERT_ALWAYS(!cmd.empty());
-    if (cmd == "exec")
-      return std::string{"  reference ... - the references which resolves to SQL input"};
-    else
-      return {};
+    return std::isalpha(static_cast<unsigned char>(c)) || c == '_' ||
+      static_cast<unsigned char>(c) >= 0x80;
   }
 
-  /// @returns The usage info of the `cmd` command.
-  static std::string usage(std::string cmd)
+  static bool is_word_char(const char c)
   {
-    ASSERT_ALWAYS(!cmd.empty());
-    std::string result{"Usage: pgspa "};
-    result.append(std::move(cmd));
-    {
-      auto opts = options(cmd);
-      auto args = arguments(cmd);
-
-      if (!opts.empty())
-        result.append(" [options]");
-      if (!args.empty())
-        result.append(" arguments");
-      result.append("\n");
-
-      if (!opts.empty())
-        result.append("\noptions:\n")
-          .append(std::move(opts)).append("\n");
-      if (!args.empty())
-        result.append("\narguments:\n")
-          .append(std::move(args)).append("\n");
-    }
-    return result;
+    return is_word_start(c) || std::isdigit(static_cast<unsigned char>(c)) || c == '$';
   }
 };
 
-// =============================================================================
+// ===========================================================================
 
-/// @brief The "version" command.
-class Version final : public Command {
+/**
+ * @brief A reader of the SQL queries of a file, which reads the file by
+ * chunks instead of loading it entirely.
+ *
+ * The queries are separated by semicolons outside of the literals, quoted
+ * identifiers, dollar-quoted strings and comments. The queries which consist
+ * only of spaces and comments are skipped. The data of `COPY ... FROM STDIN`
+ * which follows such a query can be read by `read_copy_data()`.
+ */
+class Sql_stream final {
 public:
-  Version()
-    : Command("version")
-  {}
+  /// @brief A query.
+  struct Query final {
+    /// The text of the query starting from the first non-space character.
+    std::string text;
+    /// The line number of the first character of the text (starting from 1).
+    std::size_t line{};
+    /// The column number of the first character of the text (starting from 1).
+    std::size_t column{};
+  };
 
-  explicit Version(const app::Program_parameters& params)
-    : Command{params}
-  {}
+  /// @brief The location of the data of `COPY ... FROM STDIN`.
+  struct Copy_data final {
+    /// The line number of the first line of the data (starting from 1).
+    std::size_t line{};
+    /// The offset of the data from the beginning of the file.
+    std::size_t offset{};
+    /// The size of the data (without the line "\.").
+    std::size_t size{};
+  };
 
-  void run() override
+  /// @brief The constructor.
+  explicit Sql_stream(filesystem::path path)
+    : path_{std::move(path)}
+    , stream_{std::in_place, path_, std::ios_base::binary}
+    , buffer_(64 * 1024)
   {
-    constexpr int major_version = PGSPA_VERSION_MAJOR;
-    constexpr int minor_version = PGSPA_VERSION_MINOR;
-    std::cout << major_version << "." << minor_version << "\n";
+    if (!*stream_)
+      throw std::runtime_error{"cannot open file \"" + path_.string() + "\""};
   }
-};
-
-// =============================================================================
-
-/// @brief The "init" command.
-class Init final : public Command {
-public:
-  Init()
-    : Command("init")
-  {}
 
-  explicit Init(const app::Program_parameters& params)
-    : Command{params}
+  /**
+   * @brief Constructs the reader of the `content` of the file at `path`
+   * (without reading the file).
+   *
+   * @par Requires
+   * `content` must outlive the instance.
+   */
+  Sql_stream(filesystem::path path, const std::string_view content)
+    : path_{std::move(path)}
+    , chunk_{content}
   {}
 
-  void run() override
+  /// @returns The path to the file.
+  const filesystem::path& path() const
   {
-    const auto p = filesystem::perms::owner_all |
-      filesystem::perms::group_read  | filesystem::perms::group_exec |
-      filesystem::perms::others_read | filesystem::perms::others_exec;
-    filesystem::create_directory(root_marker);
-    filesystem::permissions(root_marker, p);
+    return path_;
   }
-};
-
-// =============================================================================
 
-/**
- * @brief The base for all "online" commands.
- *
- * An "online" command - is a command that requires the interaction with a
- * PostgreSQL server to run.
- */
-class Online : public Command {
-protected:
-  Online(std::string name)
-    : Command{std::move(name)}
-  {}
+  /// @returns The offset of the next character to read from the beginning of the file.
+  std::size_t offset() const
+  {
+    return chunk_offset_ + position_;
+  }
 
-  explicit Online(Online* const delegate)
-    : delegate_{delegate}
+  /**
+   * @returns `true` if `query` is `COPY ... FROM STDIN`.
+   *
+   * @remarks Such queries are executed by using the COPY sub-protocol of libpq
+   * since pgfe doesn't implement it.
+   */
+  static bool is_copy_from_stdin(const std::string_view query)
   {
-    ASSERT_ALWAYS(is_valid());
+    using Kind = Sql_lexer::Lexeme::Kind;
+    std::vector<std::string> words; // lowercased, outside the parentheses
+    int depth{};
+    Sql_lexer lexer{query};
+    while (const auto lexeme = lexer.next()) {
+      const auto text = lexeme->text;
+      if (lexeme->kind == Kind::punctuation)
+        depth += text == "(" ? 1 : text == ")" ? -1 : 0;
+      else if (depth || lexeme->kind == Kind::space || lexeme->kind == Kind::comment)
+        continue;
+      else if (lexeme->kind == Kind::word) {
+        std::string word;
+        for (const char c : text)
+          word.push_back(static_cast<char>(std::tolower(static_cast<unsigned char>(c))));
+        words.push_back(std::move(word));
+      } else
+        words.emplace_back(1, text.front()); // a literal, quoted identifier etc
+      if (words.size() == 1 && words.front() != "copy")
+        return false;
+    }
+    const auto i = std::find(cbegin(words), cend(words), "from");
+    return i != cend(words) && i + 1 != cend(words) && *(i + 1) == "stdin";
   }
 
-  explicit Online(const app::Program_parameters& params)
-    : Command(params)
+  /// @returns The next query, or `std::nullopt` at the end of the file.
+  std::optional<Query> next()
   {
-    if (const auto& o = params.option_with_argument("host"))
-      data_->host_ = *o;
-    else
-      data_->host_ = "localhost";
+    char c{};
+    std::size_t line{}, column{};
+    while (get(c, line, column)) {
+      if (consume(c, line, column)) {
+        auto result = std::move(query_);
+        reset();
+        if (result.has_sql)
+          return std::move(result.query);
+      }
+    }
 
-    if (const auto& o = params.option_with_argument("address"))
-      data_->address_ = *o;
+    // The end of the file.
+    if (pending_)
+      resolve_pending(false);
+    auto result = std::move(query_);
+    reset();
+    if (result.has_sql)
+      return std::move(result.query);
     else
-      data_->address_ = "127.0.0.1";
+      return std::nullopt;
+  }
 
-    if (const auto& o = params.option_with_argument("port"))
-      data_->port_ = *o;
-    else
-      data_->port_ = "5432";
+  /**
+   * @brief Reads the data of `COPY ... FROM STDIN` which follows the line of
+   * the query last returned by `next()`, i.e. the lines up to the line "\."
+   * or up to the end of the file (the rest of the line of the query is
+   * skipped), and passes it to `consume(std::string_view)` by the parts of the
+   * read buffer, without copying.
+   *
+   * @returns The location of the data.
+   */
+  template<typename F>
+  Copy_data read_copy_data(F&& consume)
+  {
+    char c{};
+    std::size_t line{}, column{};
+    while (get(c, line, column) && c != '\n');
 
-    if (const auto& o = params.option_with_argument("username"))
-      data_->username_ = *o;
-    else
-      data_->username_ = os::env::current_username();
+    Copy_data result{line_, offset()};
+    const auto pass = [&](const std::string_view part)
+    {
+      if (!part.empty()) {
+        consume(part);
+        result.size += part.size();
+      }
+    };
+    const auto is_end_line = [](const std::string_view line)
+    {
+      return line == "\\." || line == "\\.\r";
+    };
 
-    if (const auto& o = params.option_with_argument("database"))
-      data_->database_ = *o;
-    else
-      data_->database_ = data_->username_;
+    /*
+     * The beginning of the line which is split between the chunks and can be
+     * the end line is held until the rest of the line is read.
+     */
+    static const std::string_view end_line_prefix{"\\.\r"};
+    std::string head;
+    bool is_line_start{true};
+    while (position_ < chunk_.size() || fill()) {
+      if (!head.empty()) {
+        while (position_ < chunk_.size() && head.size() < end_line_prefix.size() &&
+          chunk_[position_] == end_line_prefix[head.size()])
+          head.push_back(chunk_[position_++]);
+        if (position_ == chunk_.size())
+          continue;
+        else if (chunk_[position_] == '\n' && is_end_line(head)) {
+          ++position_;
+          ++line_;
+          goto end;
+        }
+        pass(head);
+        head.clear();
+        is_line_start = false;
+      }
 
-    if (const auto& o = params.option_with_argument("password"))
-      data_->password_ = *o;
+      const auto begin = position_;
+      while (position_ < chunk_.size()) {
+        if (is_line_start && chunk_[position_] == '\\') {
+          const auto rest = chunk_.substr(position_, end_line_prefix.size() + 1);
+          if (const auto size = rest.find('\n'); size != std::string_view::npos) {
+            if (is_end_line(rest.substr(0, size))) {
+              pass(chunk_.substr(begin, position_ - begin));
+              position_ += size + 1;
+              ++line_;
+              goto end;
+            }
+          } else if (position_ + rest.size() == chunk_.size() &&
+            end_line_prefix.substr(0, rest.size()) == rest) {
+            pass(chunk_.substr(begin, position_ - begin));
+            head = rest;
+            position_ = chunk_.size();
+            break;
+          }
+        }
+        if (const auto eol = chunk_.find('\n', position_); eol != std::string_view::npos) {
+          position_ = eol + 1;
+          ++line_;
+          is_line_start = true;
+        } else {
+          position_ = chunk_.size();
+          is_line_start = false;
+        }
+      }
+      if (head.empty())
+        pass(chunk_.substr(begin, position_ - begin));
+    }
+    // The end of the file.
+    if (!is_end_line(head))
+      pass(head);
 
-    if (const auto& o = params.option_with_argument("client_encoding"))
-      data_->client_encoding_ = *o;
+  end:
+    column_ = 1;
+    return result;
+  }
 
-    if (const auto& o = params.option_with_argument("connect_timeout"))
-      data_->connect_timeout_ = std::chrono::seconds{std::stoul(*o)};
-    else
-      data_->connect_timeout_ = std::chrono::seconds{8};
+private:
+  enum class State {
+    normal,
+    quote, // single quote
+    quote_end, // single quote in single quote
+    identifier, // double quote
+    identifier_end, // double quote in double quote
+    dollar_tag, // tag of the dollar quote
+    dollar_quote,
+    line_comment,
+    block_comment
+  };
 
-    ASSERT_ALWAYS(is_valid());
-  }
+  struct Current final {
+    Query query;
+    bool has_sql{};
+  };
 
-  const std::string& name() const override
+  filesystem::path path_;
+  std::optional<std::ifstream> stream_;
+  std::vector<char> buffer_;
+  std::string_view chunk_; // of `buffer_` or of the content
+  std::size_t chunk_offset_{}; // from the beginning of the file
+  std::size_t position_{}; // in `chunk_`
+  std::size_t line_{1};
+  std::size_t column_{1};
+
+  Current query_;
+  State state_{State::normal};
+  char pending_{}; // '-' or '/' which may start a comment
+  char previous_{}; // the previous character in normal state
+  bool is_escape_string_{};
+  bool is_escaped_{};
+  std::size_t identifier_length_{}; // of unquoted identifier preceding the current character
+  std::size_t block_comment_depth_{};
+  std::string dollar_tag_;
+  std::size_t dollar_match_{};
+
+  /**
+   * @brief Reads the next character `c` located at `line` and `column`.
+   *
+   * @returns `false` at the end of the file.
+   */
+  bool get(char& c, std::size_t& line, std::size_t& column)
   {
-    ASSERT_ALWAYS(delegate() || data_);
-    if (const auto* const d = delegate())
-      return d->name();
-    else
-      return Command::name();
+    if (position_ == chunk_.size() && !fill())
+      return false;
+    c = chunk_[position_++];
+    line = line_;
+    column = column_;
+    if (c == '\n') {
+      ++line_;
+      column_ = 1;
+    } else
+      ++column_;
+    return true;
   }
 
   /**
-   * @returns The delegate of this command.
+   * @brief Reads the next chunk of the file (if the current one is consumed).
    *
-   * The main goal of using delegates is to combine different commands within a
-   * single transaction. So, the Foo command can call the Bar command, providing
-   * itself as a delegate. Then the Bar command will use the `pgfe::Connection`
-   * object of the Foo command.
+   * @returns `false` at the end of the file.
    */
-  Online* delegate()
+  bool fill()
   {
-    return delegate_;
+    ASSERT(position_ == chunk_.size());
+    if (!stream_ || (!stream_->read(buffer_.data(), buffer_.size()) && !stream_->gcount()))
+      return false;
+    chunk_offset_ += chunk_.size();
+    chunk_ = {buffer_.data(), static_cast<std::size_t>(stream_->gcount())};
+    position_ = 0;
+    return true;
   }
 
-  /// @overload
-  const Online* delegate() const
+  void reset()
   {
-    return delegate_;
+    query_ = Current{};
+    state_ = State::normal;
+    pending_ = previous_ = 0;
+    identifier_length_ = 0;
   }
 
-  const std::string& database() const
+  void append(const char c, const std::size_t line, const std::size_t column)
   {
-    ASSERT_ALWAYS(delegate() || data_);
-    if (auto* const d = delegate())
-      return d->database();
-    else {
-      if (data_->database_.empty())
-        data_->database_ = data_->username_;
-      return data_->database_;
+    if (query_.query.text.empty()) {
+      if (std::isspace(static_cast<unsigned char>(c)))
+        return;
+      query_.query.line = line;
+      query_.query.column = column;
     }
+    query_.query.text.push_back(c);
   }
 
-  const std::optional<std::string>& host_name() const
+  static bool is_identifier_char(const char c)
   {
-    ASSERT_ALWAYS(delegate() || data_);
-    if (auto* const d = delegate())
-      return d->host_name();
-    else
-      return data_->host_;
+    return std::isalnum(static_cast<unsigned char>(c)) || c == '_' || c == '$' ||
+      static_cast<unsigned char>(c) >= 0x80;
   }
 
-  const std::string& host_address() const
+  /**
+   * @brief Resolves the pending '-' or '/' which is followed by the character
+   * which starts a comment (if `is_comment`) or not.
+   */
+  void resolve_pending(const bool is_comment)
   {
-    ASSERT_ALWAYS(delegate() || data_);
-    if (auto* const d = delegate())
-      return d->host_address();
-    else
-      return data_->address_;
+    if (is_comment) {
+      if (pending_ == '-')
+        state_ = State::line_comment;
+      else {
+        state_ = State::block_comment;
+        block_comment_depth_ = 1;
+        previous_ = 0;
+      }
+    } else {
+      query_.has_sql = true;
+      previous_ = pending_;
+      identifier_length_ = 0;
+    }
+    pending_ = 0;
   }
 
-  const std::string& host_port() const
+  /**
+   * @brief Consumes the character `c` located at `line` and `column`.
+   *
+   * @returns `true` if the query is ended.
+   */
+  bool consume(const char c, const std::size_t line, const std::size_t column)
   {
-    ASSERT_ALWAYS(delegate() || data_);
-    if (auto* const d = delegate())
-      return d->host_port();
-    else
-      return data_->port_;
-  }
-
+    switch (state_) {
+    case State::normal:
+      if (pending_) {
+        if ((pending_ == '-' && c == '-') || (pending_ == '/' && c == '*')) {
+          resolve_pending(true);
+          append(c, line, column);
+          return false;
+        } else
+          resolve_pending(false);
+      }
+      if (c == ';')
+        return true;
+
+      append(c, line, column);
+      if (c == '-' || c == '/') {
+        pending_ = c;
+        return false;
+      } else if (c == '\'') {
+        is_escape_string_ = (identifier_length_ == 1 && (previous_ == 'E' || previous_ == 'e'));
+        is_escaped_ = false;
+        state_ = State::quote;
+      } else if (c == '"') {
+        state_ = State::identifier;
+      } else if (c == '$' && !identifier_length_) {
+        dollar_tag_.clear();
+        state_ = State::dollar_tag;
+      }
+
+      if (!std::isspace(static_cast<unsigned char>(c)))
+        query_.has_sql = true;
+      identifier_length_ = is_identifier_char(c) ? identifier_length_ + 1 : 0;
+      previous_ = c;
+      return false;
+
+    case State::quote:
+      append(c, line, column);
+      if (is_escaped_)
+        is_escaped_ = false;
+      else if (c == '\\' && is_escape_string_)
+        is_escaped_ = true;
+      else if (c == '\'')
+        state_ = State::quote_end;
+      return false;
+
+    case State::quote_end:
+      if (c == '\'') {
+        append(c, line, column);
+        state_ = State::quote;
+        return false;
+      }
+      state_ = State::normal;
+      previous_ = '\'';
+      identifier_length_ = 0;
+      return consume(c, line, column);
+
+    case State::identifier:
+      append(c, line, column);
+      if (c == '"')
+        state_ = State::identifier_end;
+      return false;
+
+    case State::identifier_end:
+      if (c == '"') {
+        append(c, line, column);
+        state_ = State::identifier;
+        return false;
+      }
+      state_ = State::normal;
+      previous_ = '"';
+      identifier_length_ = 0;
+      return consume(c, line, column);
+
+    case State::dollar_tag:
+      if (c == '$') {
+        append(c, line, column);
+        state_ = State::dollar_quote;
+        dollar_match_ = 0;
+        return false;
+      } else if (is_identifier_char(c) && !(dollar_tag_.empty() &&
+          std::isdigit(static_cast<unsigned char>(c)))) {
+        append(c, line, column);
+        dollar_tag_.push_back(c);
+        return false;
+      }
+      // Not a dollar quote (for example, a positional parameter).
+      state_ = State::normal;
+      identifier_length_ = 0;
+      previous_ = dollar_tag_.empty() ? '$' : dollar_tag_.back();
+      return consume(c, line, column);
+
+    case State::dollar_quote:
+      append(c, line, column);
+      // The closing delimiter is "$tag$", where the tag has no dollar signs.
+      if (dollar_match_ == 0 || dollar_match_ == dollar_tag_.size() + 1) {
+        if (c == '$') {
+          if (dollar_match_) {
+            state_ = State::normal;
+            previous_ = '$';
+            identifier_length_ = 0;
+          } else
+            dollar_match_ = 1;
+        } else
+          dollar_match_ = 0;
+      } else if (c == dollar_tag_[dollar_match_ - 1])
+        ++dollar_match_;
+      else
+        dollar_match_ = (c == '$');
+      return false;
+
+    case State::line_comment:
+      append(c, line, column);
+      if (c == '\n')
+        state_ = State::normal;
+      return false;
+
+    case State::block_comment:
+      append(c, line, column);
+      if (previous_ == '/' && c == '*') {
+        ++block_comment_depth_;
+        previous_ = 0;
+      } else if (previous_ == '*' && c == '/') {
+        if (!--block_comment_depth_)
+          state_ = State::normal;
+        previous_ = 0;
+      } else
+        previous_ = c;
+      return false;
+    }
+    ASSERT_ALWAYS(!true);
+    return false;
+  }
+};
+
+// ===========================================================================
+
+/// @brief A batch of SQL commands of a file.
+class Sql_batch final {
+public:
+  /// @brief The data of the `COPY ... FROM STDIN` query.
+  struct Copy_data final {
+    /// The data which follows the query in the file (if there is no `companion`).
+    std::string_view content;
+    /// The line number of the first line of the data (starting from 1).
+    std::size_t line{};
+    /// The path to the companion file which contains the data.
+    std::optional<filesystem::path> companion;
+  };
+
+  /**
+   * @brief Loads the batch of the file at `path`.
+   *
+   * @remarks The data of the `COPY ... FROM STDIN` query is taken from the
+   * companion file (see `companion_path()`) if it exists.
+   */
+  explicit Sql_batch(const filesystem::path& path)
+    : path_{path}
+  {
+    auto content = str::file_to_string(*path_);
+    hash_ = Util::hash(content);
+    load(std::move(content), true);
+    if (const auto& companion = this->companion())
+      hash_ = Util::file_hash(*companion, hash_);
+    ASSERT_ALWAYS(is_valid());
+  }
+
+  explicit Sql_batch(std::unique_ptr<pgfe::Sql_vector>&& vec)
+    : vec_{std::move(vec)}
+  {
+    ASSERT_ALWAYS(is_valid());
+  }
+
+  /**
+   * @brief Constructs the batch of the file at `path` from its `content`
+   * (without reading the file).
+   *
+   * @remarks The data of the `COPY ... FROM STDIN` query is never taken from
+   * the companion file.
+   */
+  Sql_batch(const filesystem::path& path, const std::string& content, const std::uint64_t hash)
+    : path_{path}
+    , hash_{hash}
+  {
+    load(content, false);
+    ASSERT_ALWAYS(is_valid());
+  }
+
+  /**
+   * @remarks The SQL vector is immutable and shared between the copies (so
+   * the copying is cheap).
+   */
+  Sql_batch(const Sql_batch&) = default;
+  Sql_batch& operator=(const Sql_batch&) = default;
+  Sql_batch(Sql_batch&&) = default;
+  Sql_batch& operator=(Sql_batch&&) = default;
+
+  /**
+   * @returns The batches of the files of the specified `paths` in the same
+   * order as `paths`.
+   *
+   * @remarks The files are loaded and parsed in parallel by the pool of up to
+   * `std::thread::hardware_concurrency()` threads. If loading of several files
+   * fails, the exception of the first such a file is rethrown.
+   */
+  static std::vector<Sql_batch> make_many(const std::vector<filesystem::path>& paths)
+  {
+    const auto size = paths.size();
+    const auto thread_count = std::min<std::size_t>(size,
+      std::max(std::thread::hardware_concurrency(), 1U));
+
+    std::vector<std::optional<Sql_batch>> batches(size);
+    std::vector<std::exception_ptr> errors(size);
+    std::atomic<std::size_t> next{};
+    const auto load = [&]
+    {
+      for (auto k = next++; k < size; k = next++) {
+        try {
+          batches[k].emplace(paths[k]);
+        } catch (...) {
+          errors[k] = std::current_exception();
+        }
+      }
+    };
+    if (thread_count > 1) {
+      std::vector<std::thread> threads;
+      threads.reserve(thread_count - 1);
+      for (std::size_t t = 1; t < thread_count; ++t)
+        threads.emplace_back(load);
+      load();
+      for (auto& thread : threads)
+        thread.join();
+    } else
+      load();
+
+    std::vector<Sql_batch> result;
+    result.reserve(size);
+    for (std::size_t k = 0; k < size; ++k) {
+      if (errors[k])
+        std::rethrow_exception(errors[k]);
+      result.push_back(std::move(*batches[k]));
+    }
+    return result;
+  }
+
+  const std::optional<filesystem::path>& path() const
+  {
+    return path_;
+  }
+
+  const pgfe::Sql_vector* sql_vector() const
+  {
+    return vec_.get();
+  }
+
+  /**
+   * @returns The hash of the content of the file (and of its companion file,
+   * if any), or `0` if there is no file.
+   */
+  std::uint64_t hash() const
+  {
+    return hash_;
+  }
+
+  /**
+   * @returns The data of the `index`-th query of the SQL vector if it's
+   * `COPY ... FROM STDIN`, or `nullptr` otherwise.
+   */
+  const Copy_data* copy_data(const std::size_t index) const
+  {
+    if (copies_) {
+      if (const auto i = copies_->data.find(index); i != cend(copies_->data))
+        return &i->second;
+    }
+    return nullptr;
+  }
+
+  /// @returns `true` if the batch contains the `COPY ... FROM STDIN` queries.
+  bool has_copy_data() const
+  {
+    return static_cast<bool>(copies_);
+  }
+
+  /// @returns The path to the companion file the data of `COPY ... FROM STDIN` is taken from.
+  std::optional<filesystem::path> companion() const
+  {
+    return copies_ ? copies_->companion : std::nullopt;
+  }
+
+  /**
+   * @returns The path to the companion file of the SQL file at `path` (i.e.
+   * the file with the same name but with the extension ".csv" or ".tsv"), or
+   * `std::nullopt` if there is no such a file.
+   */
+  static std::optional<filesystem::path> companion_path(const filesystem::path& path)
+  {
+    for (const auto* const extension : {".csv", ".tsv"}) {
+      auto result = path;
+      if (filesystem::is_regular_file(result.replace_extension(extension)))
+        return result;
+    }
+    return std::nullopt;
+  }
+
+private:
+  struct Copies final {
+    std::string content; // of the file, if the data is inline
+    std::optional<filesystem::path> companion;
+    std::unordered_map<std::size_t, Copy_data> data; // by the indexes of the queries
+  };
+
+  bool is_valid() const
+  {
+    const bool vec_ok = static_cast<bool>(vec_);
+    return vec_ok;
+  }
+
+  std::shared_ptr<const pgfe::Sql_vector> vec_;
+  std::optional<filesystem::path> path_;
+  std::uint64_t hash_{};
+  std::shared_ptr<const Copies> copies_;
+
+  /**
+   * @brief Parses the `content` of the file.
+   *
+   * The data of the `COPY ... FROM STDIN` query is either the content of the
+   * companion file (if `is_companion_allowed` and it exists, in which case the
+   * file can contain only one such a query), or the lines which follow the
+   * query up to the line "\.". In the latter case the data is excluded from
+   * the SQL vector (except the line breaks, so the positions of the queries
+   * remain the same) and the `content` is retained to send the data right from
+   * it when the query is executed.
+   *
+   * @throws `std::runtime_error` on error.
+   */
+  template<typename String>
+  void load(String&& content, const bool is_companion_allowed)
+  {
+    // Only the files which mention STDIN are scanned.
+    static const std::string_view word{"stdin"};
+    const auto i = std::search(cbegin(content), cend(content), cbegin(word), cend(word),
+      [](const char lhs, const char rhs)
+      {
+        return std::tolower(static_cast<unsigned char>(lhs)) == rhs;
+      });
+    if (i == cend(content)) {
+      vec_ = pgfe::Sql_vector::make(content);
+      return;
+    }
+
+    ASSERT(path_);
+    auto copies = std::make_shared<Copies>();
+    copies->content = std::forward<String>(content);
+    if (is_companion_allowed)
+      copies->companion = companion_path(*path_);
+    const std::string_view text{copies->content};
+    std::vector<Copy_data> data; // in order of the queries
+    std::string sql; // the `text` without the inline data
+    std::size_t sql_end{}; // of the part of the `text` appended to `sql`
+    Sql_stream stream{*path_, text};
+    while (const auto query = stream.next()) {
+      if (!Sql_stream::is_copy_from_stdin(query->text))
+        continue;
+      else if (copies->companion) {
+        if (!data.empty())
+          throw std::runtime_error{path_->string() + ":" + std::to_string(query->line) +
+            ": only one COPY ... FROM STDIN can take the data from the file \"" +
+            copies->companion->string() + "\""};
+        data.push_back(Copy_data{{}, 1, copies->companion});
+        continue;
+      }
+
+      const auto location = stream.read_copy_data([](std::string_view){});
+      sql.append(text.substr(sql_end, location.offset - sql_end));
+      sql_end = stream.offset();
+      const auto lines = text.substr(location.offset, sql_end - location.offset);
+      sql.append(std::count(cbegin(lines), cend(lines), '\n'), '\n');
+      data.push_back(Copy_data{text.substr(location.offset, location.size), location.line, {}});
+    }
+    if (data.empty()) {
+      vec_ = pgfe::Sql_vector::make(copies->content);
+      return;
+    }
+    sql.append(text.substr(sql_end));
+    vec_ = pgfe::Sql_vector::make(sql);
+    if (copies->companion)
+      copies->content.clear();
+
+    // Map the COPY queries of the SQL vector to the data in order.
+    auto d = cbegin(data);
+    for (std::size_t j = 0; j < vec_->sql_string_count(); ++j) {
+      if (Sql_stream::is_copy_from_stdin(vec_->sql_string(j)->to_query_string())) {
+        if (d == cend(data))
+          break;
+        copies->data.emplace(j, *d++);
+      }
+    }
+    if (copies->data.size() != data.size())
+      throw std::runtime_error{path_->string() + ": cannot locate the data of COPY ... FROM STDIN"};
+    copies_ = std::move(copies);
+  }
+};
+
+// ===========================================================================
+
+/**
+ * @brief A cache of the batches of the SQL files.
+ *
+ * The cached batch is valid until the modification time or the size of its
+ * file is changed, or (if it contains `COPY ... FROM STDIN`) until its
+ * companion file is changed, created or removed.
+ */
+class Batch_cache final {
+public:
+  /// @returns The batches of the files of the specified `paths` in the same order.
+  std::vector<Sql_batch> batches(const std::vector<filesystem::path>& paths)
+  {
+    const std::lock_guard lg{mutex_};
+    std::vector<std::optional<Sql_batch>> cached(paths.size());
+    std::vector<filesystem::path> parsed_paths;
+    std::vector<Stamp> stamps(paths.size());
+    for (std::size_t i = 0; i < paths.size(); ++i) {
+      stamps[i] = stamp(paths[i]);
+      if (const auto e = entries_.find(paths[i]); e != cend(entries_) && e->second.stamp == stamps[i] &&
+        (!e->second.batch.has_copy_data() || e->second.companion == companion_stamp(paths[i])))
+        cached[i] = e->second.batch;
+      else
+        parsed_paths.push_back(paths[i]);
+    }
+
+    auto parsed = Sql_batch::make_many(parsed_paths);
+    auto p = begin(parsed);
+    std::vector<Sql_batch> result;
+    result.reserve(paths.size());
+    for (std::size_t i = 0; i < paths.size(); ++i) {
+      if (cached[i])
+        result.push_back(std::move(*cached[i]));
+      else {
+        auto companion = p->has_copy_data() ? companion_stamp(paths[i]) : std::nullopt;
+        entries_.insert_or_assign(paths[i], Entry{stamps[i], *p, std::move(companion)});
+        result.push_back(std::move(*p++));
+      }
+    }
+    return result;
+  }
+
+private:
+  using Stamp = std::pair<filesystem::file_time_type, std::uintmax_t>; // mtime and size
+
+  struct Entry final {
+    Stamp stamp;
+    Sql_batch batch;
+    std::optional<std::pair<filesystem::path, Stamp>> companion;
+  };
+
+  std::mutex mutex_;
+  std::map<filesystem::path, Entry> entries_;
+
+  static Stamp stamp(const filesystem::path& path)
+  {
+    return {filesystem::last_write_time(path), filesystem::file_size(path)};
+  }
+
+  /// @returns The path and the stamp of the companion file of the SQL file at `path`.
+  static std::optional<std::pair<filesystem::path, Stamp>> companion_stamp(const filesystem::path& path)
+  {
+    if (auto companion = Sql_batch::companion_path(path)) {
+      auto s = stamp(*companion);
+      return std::make_pair(std::move(*companion), std::move(s));
+    } else
+      return std::nullopt;
+  }
+};
+
+// ===========================================================================
+
+/**
+ * @brief A queue of the limited capacity to pass the values between threads.
+ *
+ * The producer is blocked while the queue is full, and the consumer is
+ * blocked while the queue is empty. After the queue is closed nothing can be
+ * pushed to it, but the values remaining in it still can be popped.
+ */
+template<typename T>
+class Bounded_queue final {
+public:
+  /// @brief The constructor.
+  explicit Bounded_queue(const std::size_t capacity)
+    : capacity_{capacity}
+  {
+    ASSERT_ALWAYS(capacity_);
+  }
+
+  /**
+   * @brief Pushes the `value` to the queue.
+   *
+   * @returns `false` if the queue is closed.
+   */
+  bool push(T value)
+  {
+    std::unique_lock lock{mutex_};
+    is_not_full_.wait(lock, [this]{ return is_closed_ || values_.size() < capacity_; });
+    if (is_closed_)
+      return false;
+    values_.push_back(std::move(value));
+    is_not_empty_.notify_one();
+    return true;
+  }
+
+  /// @returns The next value, or `std::nullopt` if the queue is closed and empty.
+  std::optional<T> pop()
+  {
+    std::unique_lock lock{mutex_};
+    is_not_empty_.wait(lock, [this]{ return is_closed_ || !values_.empty(); });
+    return take();
+  }
+
+  /// @returns The next value, or `std::nullopt` if the queue is empty.
+  std::optional<T> try_pop()
+  {
+    const std::lock_guard lg{mutex_};
+    return take();
+  }
+
+  /// @brief Closes the queue and wakes up the blocked threads.
+  void close()
+  {
+    {
+      const std::lock_guard lg{mutex_};
+      is_closed_ = true;
+    }
+    is_not_full_.notify_all();
+    is_not_empty_.notify_all();
+  }
+
+private:
+  std::size_t capacity_{};
+  bool is_closed_{};
+  std::deque<T> values_;
+  std::mutex mutex_;
+  std::condition_variable is_not_full_;
+  std::condition_variable is_not_empty_;
+
+  std::optional<T> take()
+  {
+    if (values_.empty())
+      return std::nullopt;
+    auto result = std::make_optional(std::move(values_.front()));
+    values_.pop_front();
+    is_not_full_.notify_one();
+    return result;
+  }
+};
+
+// ===========================================================================
+
+/**
+ * @brief A static analyzer of the dependencies between the SQL queries.
+ *
+ * The analyzer extracts the name of the object created by a query (CREATE
+ * SCHEMA, TABLE, VIEW, FUNCTION etc) and the names referenced by a query
+ * (including the names referenced in the bodies of functions). The results
+ * are used to pre-order the queries before the execution. The analysis is
+ * approximate: the order is just a hint for the iterative algorithm.
+ */
+class Sql_analyzer final {
+public:
+  /// @brief The kind of the object.
+  enum class Kind {
+    /// The kind is unknown (the name can denote an object of any kind).
+    any,
+    /// A schema.
+    schema,
+    /// A table, view, sequence or index.
+    relation,
+    /// A function, procedure or aggregate.
+    routine,
+    /// A type or domain.
+    type
+  };
+
+  /// @brief The name referenced by a query.
+  struct Reference final {
+    std::string name;
+    Kind kind{Kind::any};
+  };
+
+  /// @brief The result of the analysis of a query.
+  struct Objects final {
+    /// The names by which the object created by the query can be referenced.
+    std::vector<std::string> created;
+    /// The kind of the object created by the query.
+    Kind created_kind{Kind::any};
+    /// The names referenced by the query.
+    std::vector<Reference> referenced;
+    /**
+     * `true` if the query is DDL (CREATE, ALTER, COMMENT, GRANT or REVOKE)
+     * which creates or references objects and thus can be reordered. The
+     * rest of the queries (DML, DROP and unknown ones) keep their positions.
+     */
+    bool is_movable{};
+  };
+
+  /// @returns The objects created and referenced by the `query`.
+  static Objects analyze(const std::string_view query)
+  {
+    Objects result;
+    const auto tokens = tokenized(query);
+    const auto size = tokens.size();
+
+    const auto is_word = [&](const std::size_t i, const std::string_view word = {})
+    {
+      return i < size && tokens[i].kind == Token::Kind::identifier && !tokens[i].is_quoted &&
+        (word.empty() || tokens[i].text == word);
+    };
+    const auto is_dot = [&](const std::size_t i)
+    {
+      return i < size && tokens[i].kind == Token::Kind::dot;
+    };
+    const auto is_keyword = [&](const std::size_t i)
+    {
+      return is_word(i) && keywords().count(tokens[i].text);
+    };
+    const auto is_identifier = [&](const std::size_t i)
+    {
+      return i < size && tokens[i].kind == Token::Kind::identifier && !is_keyword(i);
+    };
+
+    // Extract the name of the created object.
+    std::size_t i{};
+    std::optional<std::size_t> created_name_end;
+    if (is_word(i, "create")) {
+      static const std::vector<std::string_view> modifiers{"or", "replace", "temp",
+        "temporary", "unlogged", "global", "local", "materialized", "recursive", "unique"};
+      static const std::unordered_map<std::string_view, Kind> kinds{{"schema", Kind::schema},
+        {"table", Kind::relation}, {"view", Kind::relation}, {"sequence", Kind::relation},
+        {"index", Kind::relation}, {"function", Kind::routine}, {"procedure", Kind::routine},
+        {"aggregate", Kind::routine}, {"type", Kind::type}, {"domain", Kind::type}};
+      const auto is_one_of = [&](const std::size_t i, const std::vector<std::string_view>& words)
+      {
+        return is_word(i) && std::find(cbegin(words), cend(words), tokens[i].text) != cend(words);
+      };
+
+      for (++i; is_one_of(i, modifiers); ++i);
+      if (const auto kind = is_word(i) ? kinds.find(tokens[i].text) : cend(kinds);
+          kind != cend(kinds)) {
+        const bool is_schema = kind->second == Kind::schema;
+        result.created_kind = kind->second;
+        ++i;
+        if (is_word(i, "concurrently"))
+          ++i;
+        if (is_word(i, "if") && is_word(i + 1, "not") && is_word(i + 2, "exists"))
+          i += 3;
+        if (is_schema && is_word(i, "authorization"))
+          ++i;
+
+        std::vector<std::string> name;
+        for (; is_identifier(i); i += 2) {
+          name.push_back(tokens[i].text);
+          if (!is_dot(i + 1)) {
+            ++i;
+            break;
+          }
+        }
+        if (!name.empty()) {
+          result.created.push_back(joined(name));
+          if (name.size() > 1) {
+            result.created.push_back(name.back());
+            name.pop_back();
+            result.referenced.push_back({joined(name), Kind::schema});
+          }
+          created_name_end = i;
+        }
+      }
+    } else if (is_word(i, "drop")) {
+      /*
+       * The dropping queries are never considered as dependent (and are not
+       * movable) to prevent placing them after the queries which (re-)create
+       * the objects.
+       */
+      return result;
+    }
+
+    /*
+     * Extract the referenced names. The qualified names are always considered
+     * as references (of the objects and of their schemas or tables), while the
+     * unqualified ones only in positions of the names of relations, types and
+     * functions (i.e. not the bare column names): after the keywords which
+     * introduce relations, after the type casts, before the parentheses
+     * (function calls and column lists) and after the column names (types of
+     * the columns and of the arguments). The kind of the referenced object is
+     * deduced from the position (if possible), so, for example, the function
+     * `log()` isn't considered as a dependency of the query reading the table
+     * `log`.
+     */
+    static const std::unordered_map<std::string_view, Kind> relation_keywords{
+      {"from", Kind::relation}, {"join", Kind::relation}, {"into", Kind::relation},
+      {"update", Kind::relation}, {"table", Kind::relation}, {"references", Kind::relation},
+      {"on", Kind::relation}, {"only", Kind::relation}, {"using", Kind::relation},
+      {"view", Kind::relation}, {"sequence", Kind::relation}, {"lateral", Kind::relation},
+      {"truncate", Kind::relation}, {"type", Kind::type}, {"domain", Kind::type},
+      {"setof", Kind::type}, {"returns", Kind::type}, {"of", Kind::type},
+      {"function", Kind::routine}, {"procedure", Kind::routine}, {"aggregate", Kind::routine},
+      {"schema", Kind::schema}};
+    // Returns the kind of the name at the reference position `i`, or `std::nullopt`.
+    const auto reference_kind = [&](const std::size_t i) -> std::optional<Kind>
+    {
+      const bool is_call = i + 1 < size && tokens[i + 1].kind == Token::Kind::open_paren;
+      if (i) {
+        const auto& previous = tokens[i - 1];
+        if (previous.kind == Token::Kind::cast)
+          return Kind::type;
+        else if (previous.kind == Token::Kind::identifier) {
+          if (previous.is_quoted || !keywords().count(previous.text))
+            return Kind::type; // the type of the column or of the argument
+          else if (const auto k = relation_keywords.find(previous.text); k != cend(relation_keywords))
+            return is_call && k->second == Kind::relation ? Kind::any : k->second; // `from f()`
+        }
+      }
+      return is_call ? std::make_optional(Kind::routine) : std::nullopt;
+    };
+    for (i = created_name_end.value_or(0); i < size;) {
+      if (!is_identifier(i)) {
+        ++i;
+        continue;
+      }
+
+      const auto first = i;
+      std::vector<std::string> name{tokens[i].text};
+      for (++i; is_dot(i) && i + 1 < size && tokens[i + 1].kind == Token::Kind::identifier; i += 2)
+        name.push_back(tokens[i + 1].text);
+
+      const auto kind = reference_kind(first);
+      if (name.size() > 1) {
+        for (std::size_t k = 1; k < name.size(); ++k)
+          result.referenced.push_back({joined({cbegin(name), cbegin(name) + k}), Kind::any});
+        result.referenced.push_back({joined(name), kind.value_or(Kind::any)});
+      } else if (kind)
+        result.referenced.push_back({std::move(name.front()), *kind});
+    }
+
+    static const std::unordered_set<std::string_view> ddl_keywords{"create", "alter",
+      "comment", "grant", "revoke"};
+    result.is_movable = is_word(0) && ddl_keywords.count(tokens[0].text) &&
+      (!result.created.empty() || !result.referenced.empty());
+    return result;
+  }
+
+  /**
+   * @returns The indexes of `objects` in the topological order of the
+   * dependencies between them. Only the runs of the consecutive movable
+   * queries (see `Objects::is_movable`) are sorted, while the rest of the
+   * queries keep their positions and separate the runs. The natural order is
+   * preserved as much as possible. The queries involved in cyclic
+   * dependencies are placed in the natural order after the rest ones of the
+   * run.
+   */
+  static std::vector<std::size_t> sorted(const std::vector<Objects>& objects)
+  {
+    const auto size = objects.size();
+    std::vector<std::size_t> result;
+    result.reserve(size);
+    for (std::size_t first = 0; first < size;) {
+      auto last = first + 1;
+      if (objects[first].is_movable) {
+        for (; last < size && objects[last].is_movable; ++last);
+        sort_run(objects, first, last, result);
+      } else
+        result.push_back(first);
+      first = last;
+    }
+    ASSERT(result.size() == size);
+    return result;
+  }
+
+  /**
+   * @returns The name of the missing object extracted from the error `message`
+   * (like `relation "foo.bar" does not exist` or `function foo(integer) does
+   * not exist`), or `std::nullopt` if the name cannot be extracted.
+   */
+  static std::optional<std::string> missing_object_name(const std::string_view message)
+  {
+    if (const auto b = message.find('"'); b != std::string_view::npos) {
+      if (const auto e = message.find('"', b + 1); e != std::string_view::npos && e > b + 1)
+        return std::string{message.substr(b + 1, e - b - 1)};
+    } else {
+      for (const std::string_view prefix : {"function ", "procedure "}) {
+        if (message.substr(0, prefix.size()) == prefix) {
+          if (const auto e = message.find('(', prefix.size()); e != std::string_view::npos && e > prefix.size())
+            return std::string{message.substr(prefix.size(), e - prefix.size())};
+        }
+      }
+    }
+    return std::nullopt;
+  }
+
+private:
+  struct Token final {
+    enum class Kind { identifier, dot, open_paren, cast, other };
+    Kind kind{Kind::other};
+    std::string text;
+    bool is_quoted{};
+  };
+
+  /**
+   * @returns The keywords which are never considered as the names of the
+   * objects (the reserved keywords of SQL, the keywords of the statements and
+   * the names of the built-in types).
+   */
+  static const std::unordered_set<std::string_view>& keywords()
+  {
+    static const std::unordered_set<std::string_view> result{
+      "action", "add", "after", "aggregate", "all", "alter", "always", "analyse", "analyze",
+      "and", "any", "array", "as", "asc", "asymmetric", "authorization", "before", "begin",
+      "between", "bigint", "bigserial", "binary", "bit", "bool", "boolean", "both", "by",
+      "bytea", "cache", "called", "cascade", "case", "cast", "char", "character", "check",
+      "collate", "collation", "column", "comment", "commit", "concurrently", "constraint",
+      "cost", "create", "cross", "current_catalog", "current_date", "current_role",
+      "current_schema", "current_time", "current_timestamp", "current_user", "cycle", "data",
+      "date", "dec", "decimal", "declare", "default", "deferrable", "deferred", "definer",
+      "delete", "desc", "disable", "distinct", "do", "domain", "double", "drop", "each",
+      "else", "elsif", "enable", "end", "except", "exception", "excluded", "execute", "exists",
+      "extension", "false", "fetch", "float", "for", "foreign", "freeze", "from", "full",
+      "function", "generated", "grant", "group", "having", "identity", "if", "ilike",
+      "immediate", "immutable", "in", "include", "increment", "index", "inherits",
+      "initially", "inner", "inout", "insert", "instead", "int", "integer", "intersect",
+      "interval", "into", "invoker", "is", "isnull", "join", "json", "jsonb", "key",
+      "language", "lateral", "leading", "left", "like", "limit", "local", "localtime",
+      "localtimestamp", "loop", "match", "materialized", "maxvalue", "minvalue", "natural",
+      "new", "no", "not", "notice", "notnull", "null", "nulls", "numeric", "of", "offset",
+      "old", "on", "only", "or", "order", "out", "outer", "overlaps", "owned", "owner",
+      "parallel", "partition", "perform", "placing", "plpgsql", "policy", "precision",
+      "primary", "privileges", "procedure", "raise", "real", "record", "references",
+      "rename", "replace", "restrict", "return", "returning", "returns", "revoke", "right",
+      "row", "rows", "rule", "safe", "schema", "security", "select", "sequence", "serial",
+      "session_user", "set", "setof", "similar", "smallint", "some", "sql", "stable",
+      "start", "statement", "stored", "strict", "symmetric", "table", "tablesample",
+      "temp", "temporary", "text", "then", "time", "timestamp", "timestamptz", "to",
+      "trailing", "trigger", "true", "truncate", "type", "union", "unique", "unlogged",
+      "update", "usage", "user", "using", "uuid", "values", "varchar", "variadic",
+      "verbose", "view", "void", "volatile", "when", "where", "while", "window", "with",
+      "without", "zone"};
+    return result;
+  }
+
+  /**
+   * @returns `true` if the name of the object of kind `object` can be
+   * referenced as the name of kind `reference`.
+   */
+  static bool is_matching(const Kind reference, const Kind object)
+  {
+    return reference == Kind::any || reference == object ||
+      (reference == Kind::type && object == Kind::relation); // the row type
+  }
+
+  /**
+   * @brief Appends the indexes of `objects` in range [`first`, `last`) to
+   * `result` in the topological order of the dependencies between them.
+   */
+  static void sort_run(const std::vector<Objects>& objects, const std::size_t first,
+    const std::size_t last, std::vector<std::size_t>& result)
+  {
+    const auto size = last - first;
+
+    std::unordered_map<std::string_view, std::vector<std::size_t>> creators;
+    for (std::size_t i = 0; i < size; ++i) {
+      for (const auto& name : objects[first + i].created)
+        creators[name].push_back(i);
+    }
+
+    std::vector<std::vector<std::size_t>> dependents(size);
+    std::vector<std::size_t> in_degrees(size);
+    for (std::size_t i = 0; i < size; ++i) {
+      std::vector<std::size_t> dependencies;
+      for (const auto& reference : objects[first + i].referenced) {
+        if (const auto c = creators.find(reference.name); c != cend(creators)) {
+          for (const auto j : c->second) {
+            if (j != i && is_matching(reference.kind, objects[first + j].created_kind))
+              dependencies.push_back(j);
+          }
+        }
+      }
+      std::sort(begin(dependencies), end(dependencies));
+      dependencies.erase(std::unique(begin(dependencies), end(dependencies)), end(dependencies));
+      for (const auto j : dependencies)
+        dependents[j].push_back(i);
+      in_degrees[i] = dependencies.size();
+    }
+
+    const auto result_size = result.size();
+    std::priority_queue<std::size_t, std::vector<std::size_t>, std::greater<>> ready;
+    for (std::size_t i = 0; i < size; ++i) {
+      if (!in_degrees[i])
+        ready.push(i);
+    }
+    while (!ready.empty()) {
+      const auto i = ready.top();
+      ready.pop();
+      result.push_back(first + i);
+      for (const auto j : dependents[i]) {
+        if (!--in_degrees[j])
+          ready.push(j);
+      }
+    }
+
+    if (result.size() - result_size < size) {
+      for (std::size_t i = 0; i < size; ++i) {
+        if (in_degrees[i])
+          result.push_back(first + i);
+      }
+    }
+  }
+
+  /// @returns The names joined by the dot.
+  static std::string joined(const std::vector<std::string>& name)
+  {
+    std::string result;
+    for (const auto& n : name) {
+      if (!result.empty())
+        result += '.';
+      result += n;
+    }
+    return result;
+  }
+
+  /**
+   * @returns The tokens of the `query`.
+   *
+   * @remarks The comments, literals and parameters are skipped. The contents of
+   * the dollar-quoted strings are tokenized as well since they are usually the
+   * bodies of functions.
+   */
+  static std::vector<Token> tokenized(const std::string_view query)
+  {
+    std::vector<Token> result;
+    tokenize(query, result);
+    return result;
+  }
+
+  /// @brief Appends the tokens of the `query` to `result`.
+  static void tokenize(const std::string_view query, std::vector<Token>& result)
+  {
+    using Kind = Sql_lexer::Lexeme::Kind;
+    const auto push_other = [&result]
+    {
+      if (result.empty() || result.back().kind != Token::Kind::other)
+        result.push_back(Token{});
+    };
+
+    Sql_lexer lexer{query};
+    while (const auto lexeme = lexer.next()) {
+      const auto text = lexeme->text;
+      switch (lexeme->kind) {
+      case Kind::space:
+      case Kind::comment:
+        break;
+      case Kind::quoted_identifier: {
+        Token token{Token::Kind::identifier, {}, true};
+        const bool is_closed = text.size() > 1 && text.back() == '"';
+        const auto content = text.substr(1, text.size() - 1 - is_closed);
+        for (std::size_t i = 0; i < content.size(); ++i) {
+          token.text += content[i];
+          if (content[i] == '"')
+            ++i; // the doubled quote
+        }
+        result.push_back(std::move(token));
+        break;
+      }
+      case Kind::dollar_quoted:
+        push_other();
+        tokenize(lexeme->dollar_quoted_content(), result);
+        push_other();
+        break;
+      case Kind::word: {
+        Token token{Token::Kind::identifier, {}, false};
+        for (const char c : text)
+          token.text += static_cast<char>(std::tolower(static_cast<unsigned char>(c)));
+        result.push_back(std::move(token));
+        break;
+      }
+      case Kind::punctuation:
+        if (text == ".")
+          result.push_back(Token{Token::Kind::dot, {}, false});
+        else if (text == "(")
+          result.push_back(Token{Token::Kind::open_paren, {}, false});
+        else if (text == "::")
+          result.push_back(Token{Token::Kind::cast, {}, false});
+        else
+          push_other();
+        break;
+      default:
+        push_other();
+      }
+    }
+  }
+};
+
+// ===========================================================================
+
+/**
+ * @brief A persistent order in which the queries were successfully executed.
+ *
+ * The order is learned during the execution and replayed on the next run, so
+ * the queries of a stable project are executed in a single iteration without
+ * failed attempts. Stale entries are just ignored.
+ */
+class Execution_order final {
+public:
+  /**
+   * @brief The key of a query.
+   *
+   * The key consists of the path of the SQL file relative to the project root,
+   * the hash of the query and the occurrence number of the query with the same
+   * hash in the file.
+   */
+  struct Key final {
+    std::string path;
+    std::uint64_t hash{};
+    std::size_t occurrence{};
+
+    bool operator==(const Key& rhs) const noexcept
+    {
+      return hash == rhs.hash && occurrence == rhs.occurrence && path == rhs.path;
+    }
+  };
+
+  /// @brief The constructor. Loads the order from the file `path` if it exists.
+  explicit Execution_order(filesystem::path path)
+    : path_{std::move(path)}
+  {
+    std::ifstream stream{path_};
+    std::string line;
+    while (std::getline(stream, line)) {
+      // Line format: <hash in hex> <occurrence> <path>
+      const auto p1 = line.find(' ');
+      const auto p2 = p1 != std::string::npos ? line.find(' ', p1 + 1) : std::string::npos;
+      if (p2 == std::string::npos || p2 + 1 == line.size())
+        continue; // just ignore the malformed line
+      try {
+        Key key{line.substr(p2 + 1), std::stoull(line.substr(0, p1), nullptr, 16),
+          std::stoul(line.substr(p1 + 1, p2 - p1 - 1))};
+        if (ranks_.emplace(key, keys_.size()).second)
+          keys_.push_back(std::move(key));
+      } catch (const std::logic_error&) {
+        continue; // just ignore the malformed line
+      }
+    }
+  }
+
+  /// @returns The rank of the query by the `key`, or `std::nullopt` if unknown.
+  std::optional<std::size_t> rank(const Key& key) const
+  {
+    if (const auto i = ranks_.find(key); i != cend(ranks_))
+      return i->second;
+    else
+      return std::nullopt;
+  }
+
+  /**
+   * @brief Replaces the entries of the files mentioned in `keys` with `keys`.
+   *
+   * @par Requires
+   * `keys` must be in the order of successful execution.
+   */
+  void update(const std::vector<Key>& keys)
+  {
+    std::unordered_map<std::string, bool> paths;
+    for (const auto& key : keys)
+      paths.emplace(key.path, true);
+
+    std::vector<Key> result;
+    result.reserve(keys_.size() + keys.size());
+    std::copy_if(cbegin(keys_), cend(keys_), back_inserter(result),
+      [&paths](const Key& key) { return !paths.count(key.path); });
+    result.insert(cend(result), cbegin(keys), cend(keys));
+
+    keys_ = std::move(result);
+    ranks_.clear();
+    for (std::size_t i = 0; i < keys_.size(); ++i)
+      ranks_.emplace(keys_[i], i);
+    is_modified_ = true;
+  }
+
+  /// @brief Saves the order to the file if it was modified.
+  void save() const
+  {
+    if (!is_modified_)
+      return;
+
+    auto tmp = path_;
+    tmp += ".tmp";
+    {
+      std::ofstream stream{tmp, std::ios_base::trunc};
+      if (!stream)
+        throw std::runtime_error{"cannot open file \"" + tmp.string() + "\" for writing"};
+      for (const auto& key : keys_)
+        stream << std::hex << key.hash << ' ' << std::dec << key.occurrence << ' ' << key.path << '\n';
+    }
+    filesystem::rename(tmp, path_);
+  }
+
+  /// @returns The keys of the queries of the `batch`.
+  static std::vector<std::optional<Key>> keys(const Sql_batch& batch, const filesystem::path& root)
+  {
+    const auto* const vec = batch.sql_vector();
+    std::vector<std::optional<Key>> result(vec->sql_string_count());
+    if (const auto& p = batch.path()) {
+      const auto path = Util::project_path(*p, root);
+      std::unordered_map<std::uint64_t, std::size_t> occurrences;
+      for (std::size_t i = 0; i < result.size(); ++i) {
+        if (const auto* const sql_string = vec->sql_string(i); !sql_string->is_query_empty()) {
+          const auto hash = Util::hash(sql_string->to_query_string());
+          result[i] = Key{path, hash, occurrences[hash]++};
+        }
+      }
+    }
+    return result;
+  }
+
+private:
+  struct Key_hash final {
+    std::size_t operator()(const Key& key) const noexcept
+    {
+      return static_cast<std::size_t>(key.hash ^ (key.occurrence * 1099511628211ULL));
+    }
+  };
+
+  filesystem::path path_;
+  std::vector<Key> keys_;
+  std::unordered_map<Key, std::size_t, Key_hash> ranks_;
+  bool is_modified_{};
+};
+
+// ===========================================================================
+
+/**
+ * @brief A deploy ledger.
+ *
+ * The ledger contains the hashes of the contents of the deployed SQL files,
+ * keyed by the paths of the files relative to the project root. The ledger is
+ * stored in the table `spa_ledger` of the `dmitigr_spa` extension (if it's
+ * installed in the target database) and cached in the local file.
+ */
+class Ledger final {
+public:
+  /**
+   * @brief The constructor. Loads the ledger from the database (if the
+   * extension is installed), or from the local `cache` file otherwise.
+   */
+  Ledger(pgfe::Connection* const conn, filesystem::path cache)
+    : cache_{std::move(cache)}
+  {
+    ASSERT_ALWAYS(conn);
+    conn->execute("select quote_ident(n.nspname)||'.spa_ledger'"
+      " from pg_catalog.pg_extension e"
+      " join pg_catalog.pg_namespace n on (n.oid = e.extnamespace)"
+      " where e.extname = 'dmitigr_spa' and"
+      " pg_catalog.to_regclass(quote_ident(n.nspname)||'.spa_ledger') is not null");
+    conn->for_each([this](const pgfe::Row* const r)
+    {
+      table_ = pgfe::to<std::string>(r->data(0));
+    });
+
+    if (table_) {
+      conn->execute("select path, hash from " + *table_);
+      conn->for_each([this](const pgfe::Row* const r)
+      {
+        try {
+          hashes_[pgfe::to<std::string>(r->data(0))] =
+            std::stoull(pgfe::to<std::string>(r->data(1)), nullptr, 16);
+        } catch (const std::logic_error&) {} // just ignore the malformed hash
+      });
+    } else {
+      std::ifstream stream{cache_};
+      std::string line;
+      while (std::getline(stream, line)) {
+        // Line format: <hash in hex> <path>
+        if (const auto p = line.find(' '); p != std::string::npos && p + 1 < line.size()) {
+          try {
+            hashes_[line.substr(p + 1)] = std::stoull(line.substr(0, p), nullptr, 16);
+          } catch (const std::logic_error&) {} // just ignore the malformed line
+        }
+      }
+    }
+  }
+
+  /**
+   * @returns The identity of the database of `conn`, which doesn't depend on
+   * how the database is reached (host name or address, port, proxies): the
+   * system identifier of the cluster and the OID of the database.
+   */
+  static std::string identity(pgfe::Connection* const conn)
+  {
+    ASSERT_ALWAYS(conn);
+    conn->execute("select s.system_identifier::text||'/'||d.oid::text"
+      " from pg_catalog.pg_control_system() s, pg_catalog.pg_database d"
+      " where d.datname = pg_catalog.current_database()");
+    std::string result;
+    conn->for_each([&result](const pgfe::Row* const r)
+    {
+      result = pgfe::to<std::string>(r->data(0));
+    });
+    return result;
+  }
+
+  /// @returns `true` if the content of the file at `path` with `hash` is deployed.
+  bool is_deployed(const std::string& path, const std::uint64_t hash) const
+  {
+    const auto i = hashes_.find(path);
+    return i != cend(hashes_) && i->second == hash;
+  }
+
+  /// @brief Records the deploy of the content of the file at `path` with `hash`.
+  void record(std::string path, const std::uint64_t hash)
+  {
+    if (!is_deployed(path, hash)) {
+      hashes_[path] = hash;
+      modified_.push_back(std::move(path));
+    }
+  }
+
+  /**
+   * @brief Writes the recorded entries into the database (if the extension
+   * is installed).
+   *
+   * @par Requires
+   * `conn` must be in the transaction block in which the files were deployed.
+   */
+  void flush(pgfe::Connection* const conn) const
+  {
+    ASSERT_ALWAYS(conn);
+    if (!table_ || modified_.empty())
+      return;
+
+    std::string values;
+    for (const auto& path : modified_) {
+      if (!values.empty())
+        values.append(", ");
+      values.append("(").append(conn->to_quoted_literal(path)).append(", ")
+        .append(conn->to_quoted_literal(Util::hex(hashes_.at(path)))).append(")");
+    }
+    conn->execute("insert into " + *table_ + " (path, hash) values " + values +
+      " on conflict (path) do update set hash = excluded.hash, deployed_at = now()");
+    conn->complete();
+  }
+
+  /// @brief Saves the ledger to the local cache file if it was modified.
+  void save() const
+  {
+    if (modified_.empty())
+      return;
+
+    create_directories(cache_.parent_path());
+    auto tmp = cache_;
+    tmp += ".tmp";
+    {
+      std::ofstream stream{tmp, std::ios_base::trunc};
+      if (!stream)
+        throw std::runtime_error{"cannot open file \"" + tmp.string() + "\" for writing"};
+      for (const auto& [path, hash] : hashes_)
+        stream << Util::hex(hash) << ' ' << path << '\n';
+    }
+    filesystem::rename(tmp, cache_);
+  }
+
+private:
+  filesystem::path cache_;
+  std::optional<std::string> table_;
+  std::unordered_map<std::string, std::uint64_t> hashes_;
+  std::vector<std::string> modified_;
+};
+
+// ===========================================================================
+
+/**
+ * @brief The values specified by the per-directory configuration files.
+ *
+ * The values of a directory are the values of its parent directory (or the
+ * defaults for the project root and for the directories out of the project)
+ * updated by the configuration file of the directory, if any. The values are
+ * cached per directory.
+ */
+template<typename V>
+class Directory_values final {
+public:
+  /// @brief The function which updates the values by the configuration file.
+  using Update = std::function<void(const cfg::Flat& config, V& values)>;
+
+  /**
+   * @brief The constructor.
+   *
+   * @param root The root of the project.
+   * @param defaults The values of the project root without the configuration file.
+   * @param update The function which updates the values by the configuration file.
+   */
+  Directory_values(filesystem::path root, V defaults, Update update)
+    : root_{std::move(root)}
+    , defaults_{std::move(defaults)}
+    , update_{std::move(update)}
+  {}
+
+  /// @returns The values of the directory of the file at `path`.
+  const V& values(const filesystem::path& path)
+  {
+    const std::lock_guard lg{mutex_};
+    return directory_values(path.parent_path());
+  }
+
+  /**
+   * @brief Sets the `values` of the directory of the file at `path` instead
+   * of reading the configuration files.
+   */
+  void assign(const filesystem::path& path, V values)
+  {
+    const std::lock_guard lg{mutex_};
+    directories_[path.parent_path()] = std::move(values);
+  }
+
+private:
+  filesystem::path root_;
+  V defaults_;
+  Update update_;
+  std::mutex mutex_;
+  std::map<filesystem::path, V> directories_;
+
+  const V& directory_values(const filesystem::path& directory)
+  {
+    if (const auto i = directories_.find(directory); i != cend(directories_))
+      return i->second;
+
+    V result;
+    const auto relative = directory.lexically_relative(root_);
+    if (relative.empty() || *relative.begin() == "..")
+      result = defaults_; // the directory is out of the project
+    else {
+      result = relative == "." ? defaults_ : directory_values(directory.parent_path());
+      if (const auto path = directory / per_directory_config; is_regular_file(path))
+        update_(Util::parsed_config(path), result);
+    }
+    return directories_[directory] = std::move(result);
+  }
+};
+
+// ===========================================================================
+
+/**
+ * @brief The values of the named parameters of the SQL queries.
+ *
+ * The values are taken in order of priority from: the command line options
+ * `--param.<name>=<value>`; the parameters file specified by the command line
+ * option `--params_file`; the parameters `param.<name>` of the per-directory
+ * configuration files of the directory of the SQL file and of its parent
+ * directories up to the project root. The empty value means NULL.
+ */
+class Parameters final {
+public:
+  /// @brief The values of the parameters.
+  using Values = std::map<std::string, std::optional<std::string>>;
+
+  /**
+   * @brief The constructor.
+   *
+   * @param root The root of the project.
+   * @param overrides The values of the parameters which take precedence over
+   * the values specified in the per-directory configuration files.
+   */
+  Parameters(filesystem::path root, Values overrides)
+    : overrides_{std::move(overrides)}
+    , values_{std::move(root), overrides_, [this](const cfg::Flat& config, Values& values)
+      {
+        for (const auto& [name, value] : config.parameters()) {
+          if (!name.compare(0, parameter_prefix.size(), parameter_prefix)) {
+            auto parameter = name.substr(parameter_prefix.size());
+            if (!overrides_.count(parameter))
+              values[std::move(parameter)] = value && !value->empty() ? value : std::nullopt;
+          }
+        }
+      }}
+  {}
+
+  /// @returns The values of the parameters specified by the options of `params`.
+  static Values overrides(const app::Program_parameters& params)
+  {
+    Values result;
+    if (const auto o = params.option_with_argument("params_file")) {
+      const cfg::Flat config{*o};
+      for (const auto& [name, value] : config.parameters())
+        result[name] = value && !value->empty() ? value : std::nullopt;
+    }
+    for (const auto& [name, value] : params.options()) {
+      if (!name.compare(0, parameter_prefix.size(), parameter_prefix))
+        result[name.substr(parameter_prefix.size())] =
+          value && !value->empty() ? value : std::nullopt;
+    }
+    return result;
+  }
+
+  /// @returns The values of the parameters for the queries of the SQL file at `path`.
+  const Values& values(const filesystem::path& path)
+  {
+    return values_.values(path);
+  }
+
+  /**
+   * @brief Sets the `values` of the parameters for the queries of the SQL
+   * files of the directory of `path` instead of reading the per-directory
+   * configuration files. (The overrides still take precedence.)
+   */
+  void assign(const filesystem::path& path, Values values)
+  {
+    for (const auto& [name, value] : overrides_)
+      values[name] = value;
+    values_.assign(path, std::move(values));
+  }
+
+private:
+  Values overrides_;
+  Directory_values<Values> values_;
+};
+
+// ===========================================================================
+
+/**
+ * @brief The timeouts of the queries.
+ *
+ * The timeouts of the queries of the SQL files of a directory are specified by
+ * the parameters `lock_timeout` and `statement_timeout` of the per-directory
+ * configuration files of this directory and of its parent directories (the
+ * nearest one takes precedence), or by the defaults otherwise.
+ */
+class Timeouts final {
+public:
+  /// @brief The values of the timeouts (`std::nullopt` means the default of the server).
+  struct Values final {
+    std::optional<std::string> lock_timeout;
+    std::optional<std::string> statement_timeout;
+
+    bool operator==(const Values& rhs) const
+    {
+      return lock_timeout == rhs.lock_timeout && statement_timeout == rhs.statement_timeout;
+    }
+
+    bool operator!=(const Values& rhs) const
+    {
+      return !(*this == rhs);
+    }
+  };
+
+  /**
+   * @brief The constructor.
+   *
+   * @param root The root of the project.
+   * @param defaults The timeouts of the queries of the SQL files for which
+   * no timeouts are specified in the per-directory configuration files.
+   */
+  Timeouts(filesystem::path root, Values defaults)
+    : values_{std::move(root), std::move(defaults), [](const cfg::Flat& config, Values& values)
+      {
+        const auto& parameters = config.parameters();
+        for (const auto& [name, value] : {std::pair{"lock_timeout", &values.lock_timeout},
+            std::pair{"statement_timeout", &values.statement_timeout}}) {
+          if (const auto p = parameters.find(name); p != cend(parameters))
+            *value = p->second && !p->second->empty() ? p->second : std::nullopt;
+        }
+      }}
+  {}
+
+  /// @returns The timeouts of the queries of the SQL file at `path`.
+  const Values& values(const filesystem::path& path)
+  {
+    return values_.values(path);
+  }
+
+private:
+  Directory_values<Values> values_;
+};
+
+// ===========================================================================
+
+/**
+ * @brief A bundle - the file with the contents of the SQL files of the
+ * references resolved in advance, which can be executed without the project
+ * tree.
+ *
+ * The bundle consists of the header and the payload. All the numbers are the
+ * 64-bit unsigned integers in little-endian byte order, aligned to 8 bytes.
+ * The strings are referred by their offsets (from the beginning of the
+ * payload) and sizes, so the bundle can be used as is by mapping it into the
+ * memory. The header consists of the magic "PGSPABDL", the version of the
+ * format, the size and the hash of the payload. The payload consists of the
+ * numbers of the references, of the files and of the parameters, followed by
+ * the tables of the references (name, index of the first file, number of
+ * files), of the files (path, content, hash of the content, index of the
+ * first parameter, number of parameters, reserved), of the parameters (name,
+ * value, which is NULL if its size is the maximum number) and by the strings.
+ */
+class Bundle_file final {
+public:
+  /// @brief A file of the bundle.
+  struct File final {
+    /// The path of the file relative to the project root.
+    std::string path;
+    /// The content of the file.
+    std::string content;
+    /// The hash of the content of the file.
+    std::uint64_t hash{};
+    /// The values of the named parameters of the queries of the file.
+    Parameters::Values parameters;
+  };
+
+  /// @brief A reference of the bundle.
+  struct Reference final {
+    /// The reference as it was specified.
+    std::string name;
+    /// The files the reference resolves to (in order of execution).
+    std::vector<File> files;
+  };
+
+  /// @brief The constructor.
+  explicit Bundle_file(std::vector<Reference> references)
+    : references_{std::move(references)}
+  {}
+
+  /**
+   * @brief Loads the bundle from the file at `path`.
+   *
+   * @throws `std::runtime_error` if the file is not a valid bundle.
+   */
+  explicit Bundle_file(const filesystem::path& path)
+  {
+    std::ifstream stream{path, std::ios_base::binary};
+    if (!stream)
+      throw std::runtime_error{"cannot open file \"" + path.string() + "\""};
+    const std::string data{std::istreambuf_iterator<char>{stream}, std::istreambuf_iterator<char>{}};
+
+    const auto invalid = [&path](const std::string& what)
+    {
+      return std::runtime_error{"invalid bundle \"" + path.string() + "\": " + what};
+    };
+    if (data.size() < header_size || data.compare(0, magic.size(), magic))
+      throw invalid("no header");
+    const std::string_view header{data.data(), header_size};
+    if (const auto version = number(header, 8); version != format_version)
+      throw invalid("unsupported version " + std::to_string(version));
+    const std::string_view payload{data.data() + header_size, data.size() - header_size};
+    if (number(header, 16) != payload.size())
+      throw invalid("unexpected size");
+    else if (number(header, 24) != Util::hash(payload))
+      throw invalid("checksum mismatch");
+
+    const auto at = [&](const std::uint64_t offset)
+    {
+      if (offset > payload.size() || payload.size() - offset < 8)
+        throw invalid("offset out of range");
+      return number(payload, offset);
+    };
+    const auto string_at = [&](const std::uint64_t offset) -> std::optional<std::string>
+    {
+      const auto o = at(offset), s = at(offset + 8);
+      if (s == null_size)
+        return std::nullopt;
+      else if (o > payload.size() || payload.size() - o < s)
+        throw invalid("string out of range");
+      return std::string{payload.substr(o, s)};
+    };
+
+    const auto reference_count = at(0), file_count = at(8), parameter_count = at(16);
+    if (reference_count > payload.size() / reference_entry_size ||
+      file_count > payload.size() / file_entry_size ||
+      parameter_count > payload.size() / parameter_entry_size)
+      throw invalid("too many entries");
+    const auto files_offset = counts_size + reference_count * reference_entry_size;
+    const auto parameters_offset = files_offset + file_count * file_entry_size;
+
+    references_.reserve(reference_count);
+    for (std::uint64_t r = 0; r < reference_count; ++r) {
+      const auto entry = counts_size + r * reference_entry_size;
+      auto& reference = references_.emplace_back();
+      reference.name = string_at(entry).value_or("");
+      const auto first_file = at(entry + 16), files = at(entry + 24);
+      if (first_file > file_count || file_count - first_file < files)
+        throw invalid("file index out of range");
+
+      reference.files.reserve(files);
+      for (auto f = first_file; f < first_file + files; ++f) {
+        const auto file_entry = files_offset + f * file_entry_size;
+        auto& file = reference.files.emplace_back();
+        file.path = string_at(file_entry).value_or("");
+        file.content = string_at(file_entry + 16).value_or("");
+        file.hash = at(file_entry + 32);
+        const auto first_parameter = at(file_entry + 40), parameters = at(file_entry + 48);
+        if (first_parameter > parameter_count || parameter_count - first_parameter < parameters)
+          throw invalid("parameter index out of range");
+
+        for (auto p = first_parameter; p < first_parameter + parameters; ++p) {
+          const auto parameter_entry = parameters_offset + p * parameter_entry_size;
+          file.parameters[string_at(parameter_entry).value_or("")] = string_at(parameter_entry + 16);
+        }
+      }
+    }
+  }
+
+  /// @returns The references of the bundle.
+  const std::vector<Reference>& references() const
+  {
+    return references_;
+  }
+
+  /// @brief Saves the bundle to the file at `path`.
+  void save(const filesystem::path& path) const
+  {
+    const std::uint64_t reference_count{references_.size()};
+    std::uint64_t file_count{}, parameter_count{};
+    for (const auto& reference : references_) {
+      file_count += reference.files.size();
+      for (const auto& file : reference.files)
+        parameter_count += file.parameters.size();
+    }
+
+    std::string tables, strings;
+    const auto strings_offset = counts_size + reference_count * reference_entry_size +
+      file_count * file_entry_size + parameter_count * parameter_entry_size;
+    const auto append_string = [&](const std::optional<std::string>& value)
+    {
+      append_number(tables, strings_offset + strings.size());
+      if (value) {
+        append_number(tables, value->size());
+        strings.append(*value);
+      } else
+        append_number(tables, null_size);
+    };
+
+    append_number(tables, reference_count);
+    append_number(tables, file_count);
+    append_number(tables, parameter_count);
+    std::uint64_t first_file{};
+    for (const auto& reference : references_) {
+      append_string(reference.name);
+      append_number(tables, first_file);
+      append_number(tables, reference.files.size());
+      first_file += reference.files.size();
+    }
+    std::uint64_t first_parameter{};
+    for (const auto& reference : references_) {
+      for (const auto& file : reference.files) {
+        append_string(file.path);
+        append_string(file.content);
+        append_number(tables, file.hash);
+        append_number(tables, first_parameter);
+        append_number(tables, file.parameters.size());
+        append_number(tables, 0);
+        first_parameter += file.parameters.size();
+      }
+    }
+    for (const auto& reference : references_) {
+      for (const auto& file : reference.files) {
+        for (const auto& [name, value] : file.parameters) {
+          append_string(name);
+          append_string(value);
+        }
+      }
+    }
+    ASSERT(tables.size() == strings_offset);
+    tables.append(strings);
+
+    std::string header{magic};
+    append_number(header, format_version);
+    append_number(header, tables.size());
+    append_number(header, Util::hash(tables));
+
+    auto tmp = path;
+    tmp += ".tmp";
+    {
+      std::ofstream stream{tmp, std::ios_base::binary | std::ios_base::trunc};
+      if (!stream)
+        throw std::runtime_error{"cannot open file \"" + tmp.string() + "\" for writing"};
+      if (!stream.write(header.data(), header.size()) || !stream.write(tables.data(), tables.size()))
+        throw std::runtime_error{"cannot write file \"" + tmp.string() + "\""};
+    }
+    filesystem::rename(tmp, path);
+  }
+
+private:
+  static constexpr std::string_view magic{"PGSPABDL"};
+  static constexpr std::uint64_t format_version{1};
+  static constexpr std::size_t header_size{32};
+  static constexpr std::uint64_t counts_size{24};
+  static constexpr std::uint64_t reference_entry_size{32};
+  static constexpr std::uint64_t file_entry_size{64};
+  static constexpr std::uint64_t parameter_entry_size{32};
+  static constexpr std::uint64_t null_size{std::numeric_limits<std::uint64_t>::max()};
+
+  std::vector<Reference> references_;
+
+  /// @brief Appends the `value` to the `result` in little-endian byte order.
+  static void append_number(std::string& result, const std::uint64_t value)
+  {
+    for (int i = 0; i < 8; ++i)
+      result.push_back(static_cast<char>((value >> (8 * i)) & 0xff));
+  }
+
+  /// @returns The number at the `offset` of the `data` in little-endian byte order.
+  static std::uint64_t number(const std::string_view data, const std::uint64_t offset)
+  {
+    ASSERT(offset + 8 <= data.size());
+    std::uint64_t result{};
+    for (int i = 0; i < 8; ++i)
+      result |= std::uint64_t{static_cast<unsigned char>(data[offset + i])} << (8 * i);
+    return result;
+  }
+};
+
+// ===========================================================================
+
+/**
+ * @brief An error of the `COPY ... FROM STDIN` query executed by using libpq
+ * directly (since pgfe doesn't implement the COPY sub-protocol).
+ *
+ * The accessors are the same as of `pgfe::Error`, so the both errors are
+ * reported by the same code.
+ */
+class Copy_error final : public std::runtime_error {
+public:
+  /// @brief Constructs the error from the `result` of the failed query.
+  explicit Copy_error(const PGresult* const result)
+    : std::runtime_error{field(result, PG_DIAG_MESSAGE_PRIMARY).value_or("COPY failed")}
+    , sqlstate_{field(result, PG_DIAG_SQLSTATE).value_or("XX000")}
+    , brief_{what()}
+    , detail_{field(result, PG_DIAG_MESSAGE_DETAIL)}
+    , hint_{field(result, PG_DIAG_MESSAGE_HINT)}
+    , query_position_{field(result, PG_DIAG_STATEMENT_POSITION)}
+    , context_{field(result, PG_DIAG_CONTEXT)}
+  {}
+
+  const std::string& sqlstate() const
+  {
+    return sqlstate_;
+  }
+
+  const std::string& brief() const
+  {
+    return brief_;
+  }
+
+  const std::optional<std::string>& detail() const
+  {
+    return detail_;
+  }
+
+  const std::optional<std::string>& hint() const
+  {
+    return hint_;
+  }
+
+  const std::optional<std::string>& query_position() const
+  {
+    return query_position_;
+  }
+
+  const std::optional<std::string>& context() const
+  {
+    return context_;
+  }
+
+  /**
+   * @returns The line number of the erroneous data (starting from 1), or
+   * `std::nullopt` if the error is not caused by the data.
+   *
+   * @remarks The line is extracted from the context like "COPY foo, line 3".
+   */
+  std::optional<std::size_t> data_line() const
+  {
+    static const std::string_view prefix{"COPY "}, infix{", line "};
+    if (context_ && !context_->compare(0, prefix.size(), prefix)) {
+      if (const auto p = context_->find(infix); p != std::string::npos) {
+        const auto b = p + infix.size();
+        const auto e = context_->find_first_not_of("0123456789", b);
+        if (e != b)
+          return std::stoul(context_->substr(b, e - b));
+      }
+    }
+    return std::nullopt;
+  }
+
+private:
+  std::string sqlstate_;
+  std::string brief_;
+  std::optional<std::string> detail_;
+  std::optional<std::string> hint_;
+  std::optional<std::string> query_position_;
+  std::optional<std::string> context_;
+
+  static std::optional<std::string> field(const PGresult* const result, const int code)
+  {
+    if (const char* const value = PQresultErrorField(result, code))
+      return value;
+    else
+      return std::nullopt;
+  }
+};
+
+// ===========================================================================
+
+/**
+ * @brief The machine-readable diagnostics of the execution.
+ *
+ * The diagnostics are collected during the execution and saved either as JSON
+ * lines (one object per error) or as SARIF log.
+ */
+class Diagnostics final {
+public:
+  /// @brief A format of the diagnostics.
+  enum class Format {
+    /// The Emacs-friendly text only (nothing is saved).
+    text,
+    /// JSON lines.
+    jsonl,
+    /// Static Analysis Results Interchange Format 2.1.0.
+    sarif
+  };
+
+  /// @returns The format denoted by `name`.
+  static Format to_format(const std::string_view name)
+  {
+    if (name == "text")
+      return Format::text;
+    else if (name == "jsonl")
+      return Format::jsonl;
+    else if (name == "sarif")
+      return Format::sarif;
+    else
+      throw std::runtime_error{"invalid diagnostics format \"" + std::string{name} + "\""};
+  }
+
+  /// @brief The constructor.
+  Diagnostics(filesystem::path root, const Format format)
+    : root_{std::move(root)}
+    , format_{format}
+  {
+    ASSERT(format_ != Format::text);
+  }
+
+  /**
+   * @brief Records the error `err` of the query at the `lnum` line and `cnum`
+   * column of the file at `path`, or of the internal query if `path` is empty,
+   * which occurred on the `target` (if not empty).
+   *
+   * @tparam E `pgfe::Error` or `Copy_error`.
+   */
+  template<typename E>
+  void add(const filesystem::path& path, const std::size_t lnum, const std::size_t cnum,
+    const E* const err, const std::string& target = {})
+  {
+    ASSERT(err);
+    Record record{path.empty() ? std::string{} : Util::project_path(absolute(path), root_),
+      lnum, cnum, err->sqlstate(), err->brief(), err->detail(), err->hint(), err->context(),
+      target.empty() ? std::nullopt : std::make_optional(target)};
+    const std::lock_guard lg{mutex_};
+    records_.push_back(std::move(record));
+  }
+
+  /// @brief Saves the diagnostics to the file `.pgspa/diagnostics.{jsonl|sarif}`.
+  void save() const
+  {
+    const std::lock_guard lg{mutex_};
+    const auto path = root_ / root_marker / (format_ == Format::jsonl ?
+      "diagnostics.jsonl" : "diagnostics.sarif");
+    create_directories(path.parent_path());
+    std::ofstream stream{path, std::ios_base::trunc};
+    if (!stream)
+      throw std::runtime_error{"cannot open file \"" + path.string() + "\" for writing"};
+
+    if (format_ == Format::jsonl) {
+      for (const auto& r : records_) {
+        stream << "{\"file\":" << (r.file.empty() ? "null" : Util::to_json_string(r.file))
+               << ",\"line\":" << r.line << ",\"column\":" << r.column
+               << ",\"severity\":\"error\",\"sqlstate\":" << Util::to_json_string(r.sqlstate)
+               << ",\"message\":" << Util::to_json_string(r.message);
+        const auto field = [&stream](const char* const name, const std::optional<std::string>& value)
+        {
+          if (value)
+            stream << ",\"" << name << "\":" << Util::to_json_string(*value);
+        };
+        field("detail", r.detail);
+        field("hint", r.hint);
+        field("context", r.context);
+        field("target", r.target);
+        stream << "}\n";
+      }
+    } else {
+      stream << "{\"$schema\":\"https://json.schemastore.org/sarif-2.1.0.json\",\"version\":\"2.1.0\",\n"
+             << "\"runs\":[{\"tool\":{\"driver\":{\"name\":\"pgspa\",\"version\":\""
+             << PGSPA_VERSION_MAJOR << "." << PGSPA_VERSION_MINOR
+             << "\",\"informationUri\":\"https://github.com/dmitigr/pgspa\"}},\n"
+             << "\"originalUriBaseIds\":{\"PROJECTROOT\":{\"uri\":"
+             << Util::to_json_string(filesystem::path{root_ / ""}.generic_string().insert(0, "file://"))
+             << "}},\n\"results\":[";
+      bool is_first = true;
+      for (const auto& r : records_) {
+        std::string text{r.target ? *r.target + ": " + r.message : r.message};
+        if (r.detail)
+          text.append("\nDetail: ").append(*r.detail);
+        if (r.hint)
+          text.append("\nHint: ").append(*r.hint);
+        if (r.context)
+          text.append("\nContext: ").append(*r.context);
+        stream << (is_first ? "\n" : ",\n") << "{\"ruleId\":" << Util::to_json_string(r.sqlstate)
+               << ",\"level\":\"error\",\"message\":{\"text\":" << Util::to_json_string(text) << "}";
+        if (!r.file.empty())
+          stream << ",\"locations\":[{\"physicalLocation\":{\"artifactLocation\":{\"uri\":"
+                 << Util::to_json_string(r.file) << ",\"uriBaseId\":\"PROJECTROOT\"},"
+                 << "\"region\":{\"startLine\":" << r.line << ",\"startColumn\":" << r.column << "}}}]";
+        stream << "}";
+        is_first = false;
+      }
+      stream << "]}]}\n";
+    }
+    if (!stream)
+      throw std::runtime_error{"cannot write file \"" + path.string() + "\""};
+  }
+
+private:
+  struct Record final {
+    std::string file; // relative to the root
+    std::size_t line{};
+    std::size_t column{};
+    std::string sqlstate;
+    std::string message;
+    std::optional<std::string> detail;
+    std::optional<std::string> hint;
+    std::optional<std::string> context;
+    std::optional<std::string> target;
+  };
+
+  filesystem::path root_;
+  Format format_{};
+  mutable std::mutex mutex_;
+  std::vector<Record> records_;
+};
+
+// ===========================================================================
+
+/**
+ * @brief A profile of the execution.
+ *
+ * The profile consists of the timings of the phases of the execution and of
+ * the attempts to execute the queries. It's saved both as JSON and as JSON in
+ * the Trace Event Format (which can be loaded into chrome://tracing or
+ * Perfetto).
+ */
+class Profile final {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  /// @brief An outcome of an attempt to execute a query.
+  enum class Outcome {
+    /// The query is executed successfully.
+    success,
+    /// The query is ended with an ignorable error.
+    ignored,
+    /// The query is ended with a non-fatal error and will be retried.
+    failure,
+    /// The query is ended with a fatal error.
+    fatal
+  };
+
+  /// @brief The constructor.
+  explicit Profile(filesystem::path path)
+    : path_{std::move(path)}
+    , start_{Clock::now()}
+  {}
+
+  /// @brief Records the phase `name` started at `start` and ended now.
+  void phase(std::string name, const Clock::time_point start)
+  {
+    const auto end = Clock::now();
+    const std::lock_guard lg{mutex_};
+    events_.push_back(Event{std::move(name), thread_index(), start, end - start, {}});
+  }
+
+  /**
+   * @brief Records the attempt to execute the query at `location` started at
+   * `start` and ended now.
+   */
+  void attempt(std::string location, const std::size_t attempt, const std::size_t sweep,
+    const Outcome outcome, std::string sqlstate, const Clock::time_point start)
+  {
+    const auto end = Clock::now();
+    const std::lock_guard lg{mutex_};
+    events_.push_back(Event{std::move(location), thread_index(), start, end - start,
+      Attempt{attempt, sweep, outcome, std::move(sqlstate)}});
+  }
+
+  /// @brief Adds the `count` of the sweeps of the parked queries.
+  void add_sweeps(const std::size_t count)
+  {
+    const std::lock_guard lg{mutex_};
+    sweep_count_ += count;
+  }
+
+  /**
+   * @brief Saves the profile to the file at `path` and the trace events to
+   * the file at `path` with the extension replaced by ".trace.json".
+   */
+  void save() const
+  {
+    const std::lock_guard lg{mutex_};
+    create_directories(path_.parent_path());
+    std::ofstream profile{path_, std::ios_base::trunc};
+    auto trace_path = path_;
+    trace_path.replace_extension(".trace.json");
+    std::ofstream trace{trace_path, std::ios_base::trunc};
+    if (!profile)
+      throw std::runtime_error{"cannot open file \"" + path_.string() + "\" for writing"};
+    else if (!trace)
+      throw std::runtime_error{"cannot open file \"" + trace_path.string() + "\" for writing"};
+
+    profile << "{\"sweep_count\":" << sweep_count_ << ",\n\"phases\":[";
+    bool is_first = true;
+    for (const auto& e : events_) {
+      if (!e.attempt) {
+        profile << (is_first ? "\n" : ",\n") << "{\"name\":" << Util::to_json_string(e.name)
+                << ",\"thread\":" << e.thread << ",\"start\":" << microseconds(e.start - start_)
+                << ",\"duration\":" << microseconds(e.duration) << "}";
+        is_first = false;
+      }
+    }
+    profile << "],\n\"attempts\":[";
+    is_first = true;
+    for (const auto& e : events_) {
+      if (const auto& a = e.attempt) {
+        profile << (is_first ? "\n" : ",\n") << "{\"location\":" << Util::to_json_string(e.name)
+                << ",\"attempt\":" << a->number << ",\"sweep\":" << a->sweep
+                << ",\"outcome\":\"" << to_literal(a->outcome) << "\""
+                << ",\"sqlstate\":" << Util::to_json_string(a->sqlstate)
+                << ",\"thread\":" << e.thread << ",\"start\":" << microseconds(e.start - start_)
+                << ",\"duration\":" << microseconds(e.duration) << "}";
+        is_first = false;
+      }
+    }
+    profile << "]}\n";
+
+    trace << "{\"displayTimeUnit\":\"ms\",\n\"traceEvents\":[";
+    is_first = true;
+    for (const auto& e : events_) {
+      trace << (is_first ? "\n" : ",\n") << "{\"name\":" << Util::to_json_string(e.name)
+            << ",\"cat\":\"" << (e.attempt ? "query" : "phase") << "\",\"ph\":\"X\""
+            << ",\"ts\":" << microseconds(e.start - start_) << ",\"dur\":" << microseconds(e.duration)
+            << ",\"pid\":1,\"tid\":" << e.thread;
+      if (const auto& a = e.attempt)
+        trace << ",\"args\":{\"attempt\":" << a->number << ",\"sweep\":" << a->sweep
+              << ",\"outcome\":\"" << to_literal(a->outcome) << "\",\"sqlstate\":"
+              << Util::to_json_string(a->sqlstate) << "}";
+      trace << "}";
+      is_first = false;
+    }
+    trace << "]}\n";
+
+    if (!profile.flush())
+      throw std::runtime_error{"cannot write file \"" + path_.string() + "\""};
+    else if (!trace.flush())
+      throw std::runtime_error{"cannot write file \"" + trace_path.string() + "\""};
+  }
+
+  /// @returns The summary with the `count` slowest queries.
+  std::string summary(const std::size_t count = 10) const
+  {
+    const std::lock_guard lg{mutex_};
+    struct Total final {
+      Clock::duration duration{};
+      std::size_t attempt_count{};
+    };
+    std::map<std::string_view, Total> totals;
+    std::size_t attempt_count{};
+    Clock::duration duration{};
+    for (const auto& e : events_) {
+      if (e.attempt) {
+        auto& total = totals[e.name];
+        total.duration += e.duration;
+        ++total.attempt_count;
+        duration += e.duration;
+        ++attempt_count;
+      }
+    }
+
+    std::vector<std::pair<std::string_view, Total>> slowest{cbegin(totals), cend(totals)};
+    const auto n = std::min(count, slowest.size());
+    std::partial_sort(begin(slowest), begin(slowest) + n, end(slowest), [](const auto& lhs, const auto& rhs)
+    {
+      return lhs.second.duration > rhs.second.duration;
+    });
+    slowest.resize(n);
+
+    std::ostringstream result;
+    result << std::fixed << std::setprecision(3)
+           << "Profile: " << totals.size() << " queries, " << attempt_count << " attempts, "
+           << sweep_count_ << " sweeps, " << milliseconds(duration) << " ms in queries.\n";
+    if (!slowest.empty()) {
+      result << "The slowest queries:\n";
+      for (const auto& [location, total] : slowest)
+        result << "  " << milliseconds(total.duration) << " ms " << location
+               << " (" << total.attempt_count << " attempts)\n";
+    }
+    result << "The profile is saved to \"" << path_.string() << "\".\n";
+    return result.str();
+  }
+
+private:
+  struct Attempt final {
+    std::size_t number{};
+    std::size_t sweep{};
+    Outcome outcome{};
+    std::string sqlstate;
+  };
+
+  struct Event final {
+    std::string name; // or the location of the query
+    std::size_t thread{};
+    Clock::time_point start;
+    Clock::duration duration{};
+    std::optional<Attempt> attempt;
+  };
+
+  filesystem::path path_;
+  Clock::time_point start_;
+  mutable std::mutex mutex_;
+  std::vector<Event> events_;
+  std::map<std::thread::id, std::size_t> threads_;
+  std::size_t sweep_count_{};
+
+  /// @returns The sequential index of the current thread.
+  std::size_t thread_index()
+  {
+    return threads_.emplace(std::this_thread::get_id(), threads_.size() + 1).first->second;
+  }
+
+  static long long microseconds(const Clock::duration d)
+  {
+    return std::chrono::duration_cast<std::chrono::microseconds>(d).count();
+  }
+
+  static double milliseconds(const Clock::duration d)
+  {
+    return std::chrono::duration<double, std::milli>{d}.count();
+  }
+
+  static const char* to_literal(const Outcome outcome)
+  {
+    switch (outcome) {
+    case Outcome::success: return "success";
+    case Outcome::ignored: return "ignored";
+    case Outcome::failure: return "failure";
+    case Outcome::fatal: return "fatal";
+    }
+    ASSERT_ALWAYS(!true);
+    return nullptr;
+  }
+};
+
+// ===========================================================================
+
+/// @brief A transaction guard.
+class Tx_guard final {
+public:
+  Tx_guard(const Tx_guard&) = delete;
+  Tx_guard& operator=(const Tx_guard&) = delete;
+  Tx_guard(Tx_guard&&) = delete;
+  Tx_guard& operator=(Tx_guard&&) = delete;
+
+  static void begin(pgfe::Connection* const conn)
+  {
+    ASSERT_ALWAYS(conn);
+    if (!conn->is_transaction_block_uncommitted())
+      conn->perform("begin");
+  }
+
+  static void commit(pgfe::Connection* const conn)
+  {
+    ASSERT_ALWAYS(conn);
+    if (conn->is_transaction_block_uncommitted())
+      conn->perform("commit");
+  }
+
+  static void rollback(pgfe::Connection* const conn)
+  {
+    ASSERT_ALWAYS(conn);
+    if (conn->is_transaction_block_uncommitted())
+      conn->perform("rollback");
+  }
+
+  ~Tx_guard()
+  {
+    // No care about exceptions here: let it crash.
+    rollback(conn_);
+  }
+
+  Tx_guard(pgfe::Connection* const conn)
+    : conn_{conn}
+  {
+    ASSERT_ALWAYS(conn_);
+    begin(conn_);
+  }
+
+  void commit()
+  {
+    commit(conn_);
+  }
+
+private:
+  pgfe::Connection* conn_;
+};
+
+// ===========================================================================
+
+/**
+ * @brief A canceller of the queries in progress.
+ *
+ * While the canceller exists, SIGINT or reaching the deadline marks the
+ * execution as cancelled (so no more queries are started) and cancels the
+ * queries in progress on all of the registered connections. Since the
+ * registered connections are busy and pgfe doesn't provide the cancel request
+ * of the protocol, the queries are cancelled by using `pg_cancel_backend()`
+ * via the separate connections. Such a connection is opened once per
+ * registered connection on the first cancellation and reused, since the
+ * cancellation is repeated once a second (it may come between the queries).
+ * Only the flag of SIGINT is global, so the state of the cancellation (and
+ * the registered connections) belongs to the instance.
+ */
+class Canceller final {
+public:
+  using Clock = std::chrono::steady_clock;
+
+  /// @brief The function which returns the new opened connection.
+  using Connection_maker = std::function<std::unique_ptr<pgfe::Connection>()>;
+
+private:
+  /// @brief The registered connection.
+  struct Entry final {
+    std::int_fast32_t pid{};
+    Connection_maker make_connection;
+    std::unique_ptr<pgfe::Connection> canceller; // used by the watching thread only
+  };
+
+public:
+  /// @brief The registration of the connection to cancel the queries of.
+  class Registration final {
+  public:
+    Registration(const Registration&) = delete;
+    Registration& operator=(const Registration&) = delete;
+    Registration(Registration&&) = delete;
+    Registration& operator=(Registration&&) = delete;
+
+    /**
+     * @brief The constructor.
+     *
+     * @param canceller The canceller to register the connection in.
+     * @param conn The opened connection to cancel the queries of.
+     * @param make_connection The function which makes the connections to the
+     * same server as of `conn`.
+     */
+    Registration(const Canceller& canceller, const pgfe::Connection* const conn,
+      Connection_maker make_connection)
+      : canceller_{canceller}
+    {
+      ASSERT_ALWAYS(conn && make_connection);
+      auto entry = std::make_shared<Entry>();
+      entry->pid = conn->server_pid();
+      entry->make_connection = std::move(make_connection);
+      const std::lock_guard lg{canceller_.mutex_};
+      entry_ = canceller_.connections_.insert(cend(canceller_.connections_), std::move(entry));
+    }
+
+    ~Registration()
+    {
+      const std::lock_guard lg{canceller_.mutex_};
+      canceller_.connections_.erase(entry_);
+    }
+
+  private:
+    const Canceller& canceller_;
+    std::list<std::shared_ptr<Entry>>::iterator entry_;
+  };
+
+  Canceller(const Canceller&) = delete;
+  Canceller& operator=(const Canceller&) = delete;
+  Canceller(Canceller&&) = delete;
+  Canceller& operator=(Canceller&&) = delete;
+
+  /// @brief The constructor. Starts to handle SIGINT.
+  explicit Canceller(const std::optional<Clock::time_point> deadline)
+    : deadline_{deadline}
+  {
+    is_interrupted_ = 0;
+#ifndef _WIN32
+    // The whole previous action is saved (e.g. the one without SA_RESTART installed by `serve`).
+    struct ::sigaction action{};
+    action.sa_handler = [](int) { is_interrupted_ = 1; };
+    action.sa_flags = SA_RESTART;
+    sigemptyset(&action.sa_mask);
+    ::sigaction(SIGINT, &action, &previous_action_);
+#else
+    previous_handler_ = std::signal(SIGINT, [](int) { is_interrupted_ = 1; });
+#endif
+    thread_ = std::thread{[this]{ watch(); }};
+  }
+
+  /// @brief The destructor. Restores the previous handler of SIGINT.
+  ~Canceller()
+  {
+    {
+      const std::lock_guard lg{stop_mutex_};
+      is_stopped_ = true;
+    }
+    stop_.notify_one();
+    thread_.join();
+#ifndef _WIN32
+    ::sigaction(SIGINT, &previous_action_, nullptr);
+#else
+    std::signal(SIGINT, previous_handler_ != SIG_ERR ? previous_handler_ : SIG_DFL);
+#endif
+  }
+
+  /// @throws `std::runtime_error` if the execution is cancelled.
+  void check() const
+  {
+    if (const char* const reason = reason_)
+      throw std::runtime_error{std::string{"the execution is cancelled ("} + reason + ")"};
+  }
+
+  /**
+   * @brief Sleeps for the `duration`.
+   *
+   * @throws `std::runtime_error` if the execution is cancelled.
+   */
+  void sleep_for(const Clock::duration duration) const
+  {
+    const auto until = Clock::now() + duration;
+    for (auto now = Clock::now(); now < until; now = Clock::now()) {
+      check();
+      std::this_thread::sleep_for(std::min<Clock::duration>(until - now, std::chrono::milliseconds{100}));
+    }
+    check();
+  }
+
+private:
+  inline static volatile std::sig_atomic_t is_interrupted_;
+
+  mutable std::mutex mutex_;
+  mutable std::list<std::shared_ptr<Entry>> connections_;
+  std::atomic<const char*> reason_{};
+  std::optional<Clock::time_point> deadline_;
+#ifndef _WIN32
+  struct ::sigaction previous_action_{};
+#else
+  void (*previous_handler_)(int){};
+#endif
+  std::mutex stop_mutex_;
+  std::condition_variable stop_;
+  bool is_stopped_{};
+  std::thread thread_;
+
+  void watch()
+  {
+    std::optional<Clock::time_point> cancelled_at;
+    std::unique_lock lk{stop_mutex_};
+    while (!stop_.wait_for(lk, std::chrono::milliseconds{100}, [this]{ return is_stopped_; })) {
+      const auto now = Clock::now();
+      if (!reason_) {
+        if (is_interrupted_)
+          reason_ = "interrupted";
+        else if (deadline_ && now >= *deadline_)
+          reason_ = "deadline reached";
+        else
+          continue;
+      }
+      if (!cancelled_at || now - *cancelled_at >= std::chrono::seconds{1}) {
+        cancelled_at = now;
+        lk.unlock();
+        cancel();
+        lk.lock();
+      }
+    }
+  }
+
+  void cancel()
+  {
+    std::vector<std::shared_ptr<Entry>> connections;
+    {
+      const std::lock_guard lg{mutex_};
+      connections.assign(cbegin(connections_), cend(connections_));
+    }
+    for (const auto& entry : connections) {
+      try {
+        if (!entry->canceller || !entry->canceller->is_connected())
+          entry->canceller = entry->make_connection();
+        entry->canceller->perform("select pg_catalog.pg_cancel_backend(" +
+          std::to_string(entry->pid) + ")");
+      } catch (...) {
+        entry->canceller.reset(); // just try again later
+      }
+    }
+  }
+};
+
+/**
+ * @brief A dummy exception to throw after handling of a real exception.
+ *
+ * @remarks The exception handlers of this type shouldn't have side effects.
+ */
+class Handled_exception final {};
+
+/// @brief A pgspa command.
+class Command {
+public:
+  /// @returns A new instance from the textual type identifier.
+  template<typename ... Types>
+  static std::unique_ptr<Command> make(const std::string_view name, Types&& ... params);
+
+  /// @overload
+  static std::unique_ptr<Command> make(const app::Program_parameters& params);
+
+  /// @returns The name of the command.
+  virtual const std::string& name() const
+  {
+    return name_;
+  }
+
+  /// @returns `true` if the invariant is okay, or `false` otherwise.
+  virtual bool is_valid() const
+  {
+    return !name_.empty();
+  }
+
+  /// @brief Runs the current command.
+  virtual void run() = 0;
+
+protected:
+  /// @brief The constructor.
+  Command(std::string name = {})
+    : name_{std::move(name)}
+  {}
+
+  /// @overload
+  explicit Command(const app::Program_parameters& params)
+    : name_{params.command_name().value()}
+  {}
+
+private:
+  std::string name_;
+};
+
+// =============================================================================
+
+/// @brief The "help" command.
+class Help final : public Command {
+public:
+  Help()
+    : Command("help")
+  {}
+
+  explicit Help(const app::Program_parameters& params)
+    : Command{params}
+  {
+    const auto& args = params.arguments();
+    usage_ = (args.size() != 1) ? usage("help") : usage(args.back());
+  }
+
+  void run() override
+  {
+    std::cout << usage_;
+    std::cout.flush();
+  }
+
+private:
+  std::string usage_;
+
+  /// @returns The string with the options specific to the `cmd` command, in groups.
+  static std::string options(const std::string_view cmd)
+  {
+    ASSERT_ALWAYS(!cmd.empty());
+    const std::string connection_options{
+      "  Connection:\n"
+      "    --host=<name> - the hostname of the PostgreSQL server (\"localhost\" by default).\n"
+      "    --address=<IP address> - the IP address of the PostgreSQL server to connect to (\"127.0.0.1\" by default).\n"
+      "    --port=<number> - the port number of the PostgreSQL server to operate (\"5432\" by default).\n"
+      "    --username=<name> - the name of the user to operate (current username by default).\n"
+      "    --password=<password> - the password (be aware, it may appear in the system logs!)\n"
+      "    --database=<name> - the name of the database to operate (value of --username by default).\n"
+      "    --client_encoding=<name> - the name of the client encoding to operate.\n"
+      "    --connect_timeout=<seconds> - the connect timeout in seconds (\"8\" by default).\n"};
+    if (cmd == "exec")
+      return connection_options + std::string{
+        "  Execution modes:\n"
+        "    --pipeline=<yes|no> - send the savepoint commands and the queries in the same messages (\"no\" by default).\n"
+        "    --optimistic=<yes|no> - execute each SQL file by a single message first, and query by query only on error (\"no\" by default).\n"
+        "    --server_side=<yes|no> - execute the queries within the server by the function spa_exec() of the extension dmitigr_spa (\"no\" by default).\n"
+        "    --jobs=<number> - the number of connections to execute the concurrent references, which must not depend on the other references of the invocation since all of them are executed at the same time (\"1\" by default).\n"
+        "    --stream_threshold=<megabytes> - execute the SQL files of the specified size and larger without loading them into memory (\"0\" - never, by default).\n"
+        "    --queue_depth=<number> - start the execution before all of the SQL files are parsed, keeping up to the specified number of them parsed in advance (\"0\" - never, by default).\n"
+        "  Ordering:\n"
+        "    --learned_order=<yes|no> - replay and learn the order of successful execution of the queries (\"yes\" by default).\n"
+        "    --analysis=<yes|no> - pre-order the queries by the static analysis of dependencies (\"yes\" by default).\n"
+        "  Selection:\n"
+        "    --incremental=<yes|no> - execute only the changed files and the files dependent on them (\"no\" by default).\n"
+        "    --tree_index=<yes|no> - use the index of the project tree to avoid listing of unchanged directories (\"no\" by default).\n"
+        "  Parameters:\n"
+        "    --param.<name>=<value> - the value of the named parameter of the queries (the empty value means NULL).\n"
+        "    --params_file=<path> - the file with the values of the named parameters of the queries.\n"
+        "  Locks and cancellation:\n"
+        "    --lock_timeout=<value> - the lock_timeout of the queries unless specified in .pgspa_config (\"10s\" with jobs, the default of the server otherwise, by default).\n"
+        "    --statement_timeout=<value> - the statement_timeout of the queries unless specified in .pgspa_config (the default of the server by default).\n"
+        "    --lock_retries=<number> - the number of the retries of the queries ended with the lock timeout per reference (\"3\" by default).\n"
+        "    --lock_backoff=<milliseconds> - the base delay before the retry of the query ended with the lock timeout, doubled after each retry and randomized (\"100\" by default).\n"
+        "    --deadline=<seconds> - cancel the execution if it's not completed in the specified time (\"0\" - never, by default).\n"
+        "  Reporting:\n"
+        "    --profile=<yes|no> - record the timings of the phases and of the queries to .pgspa/profile.json (\"no\" by default).\n"
+        "    --diagnostics_format=<text|jsonl|sarif> - the format of the diagnostics (\"text\" - print only, by default; otherwise also save to .pgspa/diagnostics.<jsonl|sarif>).\n"
+        "  Deployment modes:\n"
+        "    --server=<yes|no> - forward the execution to the server started by \"pgspa serve\" (\"no\" by default).\n"
+        "    --targets=<path> - the file with the connection options of the databases to execute on concurrently (one per line).\n"
+        "    --two_phase=<yes|no> - commit on the targets (or the connections of the jobs) by using the two-phase commit (\"no\" by default).\n"
+        "    --bundle=<path> - execute the bundle made by \"pgspa bundle\" instead of the project tree (the arguments select its references)."};
+    else if (cmd == "watch")
+      return connection_options + std::string{
+        "  Execution:\n"
+        "    --pipeline=<yes|no> - send the savepoint commands and the queries in the same messages (\"no\" by default).\n"
+        "    --optimistic=<yes|no> - execute each SQL file by a single message first, and query by query only on error (\"no\" by default).\n"
+        "    --commit=<yes|no> - commit each successful execution (\"yes\" by default).\n"
+        "  Ordering:\n"
+        "    --learned_order=<yes|no> - replay and learn the order of successful execution of the queries (\"yes\" by default).\n"
+        "    --analysis=<yes|no> - pre-order the queries by the static analysis of dependencies (\"yes\" by default).\n"
+        "  Parameters:\n"
+        "    --param.<name>=<value> - the value of the named parameter of the queries (the empty value means NULL).\n"
+        "    --params_file=<path> - the file with the values of the named parameters of the queries."};
+    else if (cmd == "bundle")
+      return std::string{
+        "  Output:\n"
+        "    --output=<path> - the path of the bundle to write.\n"
+        "  Selection:\n"
+        "    --tree_index=<yes|no> - use the index of the project tree to avoid listing of unchanged directories (\"no\" by default).\n"
+        "  Parameters:\n"
+        "    --param.<name>=<value> - the value of the named parameter of the queries (the empty value means NULL).\n"
+        "    --params_file=<path> - the file with the values of the named parameters of the queries."};
+    else
+      return {};
+  }
+
+  /// @returns The string with the arguments specific to the `cmd` command.
+  static std::string arguments(const std::string_view cmd)
+  {
+    ASSERT_ALWAYS(!cmd.empty());
+    if (cmd == "exec" || cmd == "watch" || cmd == "bundle")
+      return std::string{"  reference ... - the references which resolves to SQL input"};
+    else
+      return {};
+  }
+
+  /// @returns The usage info of the `cmd` command.
+  static std::string usage(std::string cmd)
+  {
+    ASSERT_ALWAYS(!cmd.empty());
+    std::string result{"Usage: pgspa "};
+    result.append(std::move(cmd));
+    {
+      auto opts = options(cmd);
+      auto args = arguments(cmd);
+
+      if (!opts.empty())
+        result.append(" [options]");
+      if (!args.empty())
+        result.append(" arguments");
+      result.append("\n");
+
+      if (!opts.empty())
+        result.append("\noptions:\n")
+          .append(std::move(opts)).append("\n");
+      if (!args.empty())
+        result.append("\narguments:\n")
+          .append(std::move(args)).append("\n");
+    }
+    return result;
+  }
+};
+
+// =============================================================================
+
+/// @brief The "version" command.
+class Version final : public Command {
+public:
+  Version()
+    : Command("version")
+  {}
+
+  explicit Version(const app::Program_parameters& params)
+    : Command{params}
+  {}
+
+  void run() override
+  {
+    constexpr int major_version = PGSPA_VERSION_MAJOR;
+    constexpr int minor_version = PGSPA_VERSION_MINOR;
+    std::cout << major_version << "." << minor_version << "\n";
+  }
+};
+
+// =============================================================================
+
+/// @brief The "init" command.
+class Init final : public Command {
+public:
+  Init()
+    : Command("init")
+  {}
+
+  explicit Init(const app::Program_parameters& params)
+    : Command{params}
+  {}
+
+  void run() override
+  {
+    const auto p = filesystem::perms::owner_all |
+      filesystem::perms::group_read  | filesystem::perms::group_exec |
+      filesystem::perms::others_read | filesystem::perms::others_exec;
+    filesystem::create_directory(root_marker);
+    filesystem::permissions(root_marker, p);
+  }
+};
+
+// =============================================================================
+
+/**
+ * @brief The base for all "online" commands.
+ *
+ * An "online" command - is a command that requires the interaction with a
+ * PostgreSQL server to run.
+ */
+class Online : public Command {
+public:
+  /**
+   * @returns The key which identifies the options of the connection (i.e.
+   * the commands with the same keys can share the same connection).
+   */
+  std::string connection_key() const
+  {
+    ASSERT_ALWAYS(delegate() || data_);
+    if (const auto* const d = delegate())
+      return d->connection_key();
+
+    std::string result;
+    for (const auto& part : {host_address(), host_name().value_or(""), host_port(),
+        database(), username(), password().value_or(""), data_->client_encoding_})
+      result.append(part).push_back('\0');
+    return result;
+  }
+
+  /// @brief Makes the command to use the connection `conn` (opened or not).
+  void adopt_connection(std::unique_ptr<pgfe::Connection> conn)
+  {
+    ASSERT_ALWAYS(!delegate() && data_ && conn);
+    data_->conn_ = std::move(conn);
+  }
+
+  /// @returns The connection of the command (if any), released from it.
+  std::unique_ptr<pgfe::Connection> release_connection()
+  {
+    ASSERT_ALWAYS(!delegate() && data_);
+    return std::move(data_->conn_);
+  }
+
+protected:
+  Online(std::string name)
+    : Command{std::move(name)}
+  {}
+
+  explicit Online(Online* const delegate)
+    : delegate_{delegate}
+  {
+    ASSERT_ALWAYS(is_valid());
+  }
+
+  explicit Online(const app::Program_parameters& params)
+    : Command(params)
+  {
+    if (const auto& o = params.option_with_argument("host"))
+      data_->host_ = *o;
+    else
+      data_->host_ = "localhost";
+
+    if (const auto& o = params.option_with_argument("address"))
+      data_->address_ = *o;
+    else
+      data_->address_ = "127.0.0.1";
+
+    if (const auto& o = params.option_with_argument("port"))
+      data_->port_ = *o;
+    else
+      data_->port_ = "5432";
+
+    if (const auto& o = params.option_with_argument("username"))
+      data_->username_ = *o;
+    else
+      data_->username_ = os::env::current_username();
+
+    if (const auto& o = params.option_with_argument("database"))
+      data_->database_ = *o;
+    else
+      data_->database_ = data_->username_;
+
+    if (const auto& o = params.option_with_argument("password"))
+      data_->password_ = *o;
+
+    if (const auto& o = params.option_with_argument("client_encoding"))
+      data_->client_encoding_ = *o;
+
+    if (const auto& o = params.option_with_argument("connect_timeout"))
+      data_->connect_timeout_ = std::chrono::seconds{std::stoul(*o)};
+    else
+      data_->connect_timeout_ = std::chrono::seconds{8};
+
+    ASSERT_ALWAYS(is_valid());
+  }
+
+  const std::string& name() const override
+  {
+    ASSERT_ALWAYS(delegate() || data_);
+    if (const auto* const d = delegate())
+      return d->name();
+    else
+      return Command::name();
+  }
+
+  /**
+   * @returns The delegate of this command.
+   *
+   * The main goal of using delegates is to combine different commands within a
+   * single transaction. So, the Foo command can call the Bar command, providing
+   * itself as a delegate. Then the Bar command will use the `pgfe::Connection`
+   * object of the Foo command.
+   */
+  Online* delegate()
+  {
+    return delegate_;
+  }
+
+  /// @overload
+  const Online* delegate() const
+  {
+    return delegate_;
+  }
+
+  const std::string& database() const
+  {
+    ASSERT_ALWAYS(delegate() || data_);
+    if (auto* const d = delegate())
+      return d->database();
+    else {
+      if (data_->database_.empty())
+        data_->database_ = data_->username_;
+      return data_->database_;
+    }
+  }
+
+  const std::optional<std::string>& host_name() const
+  {
+    ASSERT_ALWAYS(delegate() || data_);
+    if (auto* const d = delegate())
+      return d->host_name();
+    else
+      return data_->host_;
+  }
+
+  const std::string& host_address() const
+  {
+    ASSERT_ALWAYS(delegate() || data_);
+    if (auto* const d = delegate())
+      return d->host_address();
+    else
+      return data_->address_;
+  }
+
+  const std::string& host_port() const
+  {
+    ASSERT_ALWAYS(delegate() || data_);
+    if (auto* const d = delegate())
+      return d->host_port();
+    else
+      return data_->port_;
+  }
+
   const std::string& username() const
   {
-    ASSERT_ALWAYS(delegate() || data_);
-    if (auto* const d = delegate())
-      return d->username();
-    else
-      return data_->username_;
+    ASSERT_ALWAYS(delegate() || data_);
+    if (auto* const d = delegate())
+      return d->username();
+    else
+      return data_->username_;
+  }
+
+  const std::optional<std::string>& password() const
+  {
+    ASSERT_ALWAYS(delegate() || data_);
+    if (auto* const d = delegate())
+      return d->password();
+    else
+      return data_->password_;
+  }
+
+  std::chrono::seconds connect_timeout() const
+  {
+    ASSERT_ALWAYS(delegate() || data_);
+    if (auto* const d = delegate())
+      return d->connect_timeout();
+    else
+      return data_->connect_timeout_;
+  }
+
+  /// @returns The opened connection to the PostgreSQL server.
+  pgfe::Connection* conn()
+  {
+    ASSERT_ALWAYS(delegate() || data_);
+    if (auto* const d = delegate()) {
+      return d->conn();
+    } else {
+      auto& conn = data_->conn_;
+      if (!conn)
+        conn = make_connection();
+      else if (!conn->is_connected())
+        connect(conn.get());
+      return conn.get();
+    }
+  }
+
+  /**
+   * @returns The new opened connection to the PostgreSQL server with the
+   * same options as of the connection returned by `conn()`.
+   */
+  std::unique_ptr<pgfe::Connection> make_connection() const
+  {
+    ASSERT_ALWAYS(delegate() || data_);
+    namespace pgfe = dmitigr::pgfe;
+    if (const auto* const d = delegate()) {
+      return d->make_connection();
+    } else {
+      auto result = pgfe::Connection_options::make(pgfe::Communication_mode::net)->
+        set_net_address(host_address())->
+        set_net_hostname(host_name())->
+        set_port(std::stoi(host_port()))->
+        set_database(database())->
+        set_username(username())->
+        set_password(password())->
+        make_connection();
+      connect(result.get());
+      return result;
+    }
+  }
+
+  bool is_valid() const override
+  {
+    return (data_ && !delegate() && Command::is_valid()) ||
+      (!data_ && delegate() && delegate()->is_valid());
+  }
+
+private:
+  /// @brief Opens the connection `conn` and sets the client encoding (if any).
+  void connect(pgfe::Connection* const conn) const
+  {
+    ASSERT_ALWAYS(conn && data_);
+    conn->connect(data_->connect_timeout_);
+    if (!data_->client_encoding_.empty())
+      conn->perform("set client_encoding to " +
+        conn->to_quoted_identifier(data_->client_encoding_));
+  }
+
+  struct Data final {
+    std::string name_;
+
+    std::string address_;
+    std::optional<std::string> host_;
+    std::string port_;
+    std::string database_;
+    std::string username_;
+    std::optional<std::string> password_;
+    std::string client_encoding_;
+
+    std::chrono::seconds connect_timeout_;
+
+    std::unique_ptr<pgfe::Connection> conn_;
+  };
+  mutable std::optional<Data> data_{Data{}};
+  Online* delegate_{};
+};
+
+// =============================================================================
+
+#ifndef _WIN32
+/**
+ * @brief The local (Unix domain) socket of the server of the project.
+ *
+ * The protocol is as follows. The client sends the arguments of the command
+ * `exec` (each one is terminated by the zero byte) and shuts down its side of
+ * the socket. The server responds by the frames `<channel><size>\n<data>`,
+ * where the channel is "o" (for the standard output) or "e" (for the standard
+ * error), and finishes by the frame `x<exit code>\n`.
+ */
+class Server_socket final {
+public:
+  Server_socket(const Server_socket&) = delete;
+  Server_socket& operator=(const Server_socket&) = delete;
+  Server_socket(Server_socket&&) = delete;
+  Server_socket& operator=(Server_socket&&) = delete;
+
+  ~Server_socket()
+  {
+    if (fd_ >= 0)
+      ::close(fd_);
+  }
+
+  /// @brief The constructor. Takes the ownership of the socket `fd`.
+  explicit Server_socket(const int fd)
+    : fd_{fd}
+  {}
+
+  /// @returns The path of the socket of the server of the project `root`.
+  static filesystem::path path(const filesystem::path& root)
+  {
+    return root / root_marker / "server.sock";
+  }
+
+  /// @returns The address of the socket at `path`.
+  static ::sockaddr_un address(const filesystem::path& path)
+  {
+    ::sockaddr_un result{};
+    result.sun_family = AF_UNIX;
+    const auto& str = path.string();
+    if (str.size() >= sizeof(result.sun_path))
+      throw std::runtime_error{"the path of the socket \"" + str + "\" is too long"};
+    std::memcpy(result.sun_path, str.c_str(), str.size() + 1);
+    return result;
+  }
+
+  /// @returns The socket connected to the server of the project `root`, or `nullptr`.
+  static std::unique_ptr<Server_socket> connect(const filesystem::path& root)
+  {
+    const auto addr = address(path(root));
+    auto result = std::make_unique<Server_socket>(::socket(AF_UNIX, SOCK_STREAM, 0));
+    if (result->fd_ < 0)
+      throw std::system_error{errno, std::system_category(), "cannot create socket"};
+    else if (::connect(result->fd_, reinterpret_cast<const ::sockaddr*>(&addr), sizeof(addr)))
+      return nullptr;
+    return result;
+  }
+
+  /// @returns The descriptor of the socket.
+  int fd() const
+  {
+    return fd_;
+  }
+
+  /// @brief Sends the `size` bytes of `data`. (Returns `false` on failure.)
+  bool send(const char* data, std::size_t size)
+  {
+    while (size) {
+      const auto n = ::send(fd_, data, size, MSG_NOSIGNAL);
+      if (n < 0) {
+        if (errno == EINTR)
+          continue;
+        return false;
+      }
+      data += n;
+      size -= static_cast<std::size_t>(n);
+    }
+    return true;
+  }
+
+  /// @brief Receives up to `size` bytes into `data`. (Returns `0` at the end.)
+  std::size_t receive(char* const data, const std::size_t size)
+  {
+    while (true) {
+      if (const auto n = ::recv(fd_, data, size, 0); n >= 0)
+        return static_cast<std::size_t>(n);
+      else if (errno != EINTR)
+        throw std::system_error{errno, std::system_category(), "cannot receive from socket"};
+    }
+  }
+
+  /// @brief Sends the header of the frame of the `channel` with the `value`.
+  bool send_header(const char channel, const std::size_t value)
+  {
+    const auto header = channel + std::to_string(value) + "\n";
+    return send(header.data(), header.size());
+  }
+
+  /// @brief Sends the frame of the `channel` with the `data`.
+  bool send_frame(const char channel, const std::string_view data)
+  {
+    return send_header(channel, data.size()) && send(data.data(), data.size());
+  }
+
+private:
+  int fd_{-1};
+};
+
+/**
+ * @brief The client of the server of the project.
+ *
+ * Forwards the `exec` command to the server and prints its output.
+ */
+struct Server_client final {
+  /**
+   * @returns The exit code of the command `exec` with the arguments `args`
+   * executed by the server of the project `root`.
+   */
+  static int exec(const filesystem::path& root, const std::vector<std::string>& args)
+  {
+    const auto socket = Server_socket::connect(root);
+    if (!socket)
+      throw std::runtime_error{"cannot connect to the server at \"" +
+        Server_socket::path(root).string() + "\" (is \"pgspa serve\" running?)"};
+
+    std::string request;
+    for (const auto& arg : args)
+      request.append(arg).push_back('\0');
+    if (!socket->send(request.data(), request.size()))
+      throw std::system_error{errno, std::system_category(), "cannot send to socket"};
+    ::shutdown(socket->fd(), SHUT_WR);
+
+    std::string buffer;
+    std::array<char, 64 * 1024> chunk;
+    while (true) {
+      const auto header_end = buffer.find('\n');
+      if (header_end != std::string::npos) {
+        const auto channel = buffer.front();
+        const auto value = std::stoul(buffer.substr(1, header_end - 1));
+        if (channel == 'x') {
+          std::cout.flush();
+          return static_cast<int>(value);
+        } else if (buffer.size() >= header_end + 1 + value) {
+          auto& stream = channel == 'e' ? std::cerr : std::cout;
+          stream.write(buffer.data() + header_end + 1, static_cast<std::streamsize>(value));
+          buffer.erase(0, header_end + 1 + value);
+          continue;
+        }
+      }
+      if (const auto n = socket->receive(chunk.data(), chunk.size()))
+        buffer.append(chunk.data(), n);
+      else
+        throw std::runtime_error{"the server closed the connection unexpectedly"};
+    }
+  }
+};
+#endif
+
+// =============================================================================
+
+/**
+ * @brief The `exec` command.
+ *
+ * The `exec` command executes the bunch of specified SQL queries.
+ */
+class Exec final : public Online {
+public:
+  Exec()
+    : Online{"exec"}
+  {}
+
+  explicit Exec(Online* const delegate)
+    : Online{delegate}
+  {
+    ASSERT_ALWAYS(is_valid());
+  }
+
+  /**
+   * @brief The constructor.
+   *
+   * @param cache The cache of the batches to use instead of loading of the
+   * SQL files every time. (Can be `nullptr`.)
+   */
+  explicit Exec(const app::Program_parameters& params, Batch_cache* const cache = nullptr)
+    : Online{params}
+    , args_{params.arguments()}
+    , cache_{cache}
+  {
+    // The options are grouped as in the help.
+    auto options = std::vector<std::string>{
+      "host", "address", "port", "username", "password", "database", "client_encoding", "connect_timeout",
+      "pipeline", "optimistic", "server_side", "jobs", "stream_threshold", "queue_depth",
+      "learned_order", "analysis",
+      "incremental", "tree_index",
+      "params_file",
+      "lock_timeout", "statement_timeout", "lock_retries", "lock_backoff", "deadline",
+      "profile", "diagnostics_format",
+      "server", "targets", "two_phase", "bundle"};
+    for (const auto& o : params.options()) {
+      if (!o.first.compare(0, parameter_prefix.size(), parameter_prefix))
+        options.push_back(o.first);
+    }
+    Util::check_options(params, options);
+
+    options_.pipeline = Util::boolean_option(params, "pipeline").value_or(false);
+    options_.learned_order = Util::boolean_option(params, "learned_order").value_or(true);
+    options_.analysis = Util::boolean_option(params, "analysis").value_or(true);
+    options_.incremental = Util::boolean_option(params, "incremental").value_or(false);
+    if (const auto o = params.option_with_argument("jobs")) {
+      options_.jobs = std::stoul(*o);
+      if (!options_.jobs)
+        throw std::runtime_error{"invalid value of option jobs (must be positive)"};
+    }
+    options_.tree_index = Util::boolean_option(params, "tree_index").value_or(false);
+    options_.profile = Util::boolean_option(params, "profile").value_or(false);
+    options_.optimistic = Util::boolean_option(params, "optimistic").value_or(false);
+    if (const auto o = params.option_with_argument("stream_threshold"))
+      options_.stream_threshold = std::stoull(*o) * 1024 * 1024;
+    if (const auto o = params.option_with_argument("diagnostics_format"))
+      options_.diagnostics_format = Diagnostics::to_format(*o);
+    parameters_ = Parameters::overrides(params);
+    if (const auto o = params.option_with_argument("queue_depth")) {
+      options_.queue_depth = std::stoul(*o);
+      if (options_.queue_depth && (options_.incremental || options_.jobs > 1 || options_.stream_threshold))
+        throw std::runtime_error{"the option queue_depth cannot be used with the options"
+          " incremental, jobs and stream_threshold"};
+    }
+    options_.server_side = Util::boolean_option(params, "server_side").value_or(false);
+    if (const auto o = params.option_with_argument("lock_timeout"); o && !o->empty())
+      options_.timeouts.lock_timeout = o;
+    if (const auto o = params.option_with_argument("statement_timeout"); o && !o->empty())
+      options_.timeouts.statement_timeout = o;
+    if (options_.jobs > 1 && !params.option_with_argument("lock_timeout")) {
+      // The locks held by the transactions of the finished jobs are released only at the end.
+      options_.timeouts.lock_timeout = jobs_lock_timeout;
+    }
+    if (const auto o = params.option_with_argument("lock_retries"))
+      options_.lock_retries = std::stoul(*o);
+    if (const auto o = params.option_with_argument("lock_backoff"))
+      options_.lock_backoff = std::chrono::milliseconds{std::stoul(*o)};
+    if (const auto o = params.option_with_argument("deadline"))
+      options_.deadline = std::chrono::seconds{std::stoul(*o)};
+    options_.two_phase = Util::boolean_option(params, "two_phase").value_or(false);
+    if (const auto o = params.option_with_argument("targets")) {
+      if (options_.incremental || options_.jobs > 1 || options_.stream_threshold || options_.queue_depth)
+        throw std::runtime_error{"the option targets cannot be used with the options"
+          " incremental, jobs, stream_threshold and queue_depth"};
+      targets_ = make_targets(params, *o);
+    } else if (options_.two_phase && options_.jobs < 2)
+      throw std::runtime_error{"the option two_phase can be used only with the options targets and jobs"};
+    if (const auto o = params.option_with_argument("bundle")) {
+      for (const auto& name : {"learned_order", "incremental", "jobs", "tree_index", "profile",
+          "stream_threshold", "diagnostics_format", "server", "targets", "queue_depth"}) {
+        if (params.options().count(name))
+          throw std::runtime_error{std::string{"the option "} + name +
+            " cannot be used with the option bundle"};
+      }
+      options_.learned_order = false;
+      bundle_ = *o;
+    }
+    if (Util::boolean_option(params, "server").value_or(false)) {
+      /*
+       * The command line to forward to the server (without the option
+       * "server"). The paths of the files are made absolute, since they're
+       * relative to the working directory of the client.
+       */
+      server_args_.emplace_back("exec");
+      for (const auto& [name, value] : params.options()) {
+        if (name == "server")
+          continue;
+        else if (value && (name == "params_file" || name == "targets" || name == "bundle"))
+          server_args_.push_back("--" + name + "=" + filesystem::absolute(*value).string());
+        else
+          server_args_.push_back("--" + name + (value ? "=" + *value : std::string{}));
+      }
+      server_args_.insert(cend(server_args_), cbegin(args_), cend(args_));
+    }
+
+    if (args_.empty() && bundle_.empty())
+      throw std::runtime_error("no references specified");
+
+    ASSERT_ALWAYS(is_valid());
+  }
+
+  bool is_valid() const override
+  {
+    return (!args_.empty() || !bundle_.empty()) && Online::is_valid();
+  }
+
+  void run() override
+  {
+    if (!server_args_.empty()) {
+#ifndef _WIN32
+      if (Server_client::exec(Util::root_path(), server_args_))
+        throw Handled_exception{};
+      return;
+#else
+      throw std::runtime_error{"the option \"server\" is not supported on Windows"};
+#endif
+    }
+
+    const Canceller canceller{options_.deadline.count() ?
+      std::make_optional(Canceller::Clock::now() + options_.deadline) : std::nullopt};
+    if (!bundle_.empty())
+      return run_bundle(canceller);
+
+    std::optional<Profile> profile;
+    if (options_.profile)
+      profile.emplace(Util::root_path() / root_marker / "profile.json");
+    std::optional<Diagnostics> diagnostics;
+    if (options_.diagnostics_format != Diagnostics::Format::text)
+      diagnostics.emplace(Util::root_path(), options_.diagnostics_format);
+
+    const auto save = [&profile, &diagnostics]
+    {
+      if (profile)
+        profile->save();
+      if (diagnostics)
+        diagnostics->save();
+    };
+    try {
+      run(profile ? &*profile : nullptr, diagnostics ? &*diagnostics : nullptr, canceller);
+    } catch (...) {
+      save();
+      throw;
+    }
+    save();
+    if (profile)
+      std::cout << profile->summary();
+  }
+
+  /// @brief The options of the execution.
+  struct Options final {
+    /**
+     * If `true` then the savepoint commands are sent to the server along with
+     * the queries in a single message (by using the simple query protocol) in
+     * order to reduce the number of the network round-trips.
+     */
+    bool pipeline{};
+
+    /// If `true` then the learned order of execution is used.
+    bool learned_order{true};
+
+    /// If `true` then the queries are pre-ordered by the static analysis.
+    bool analysis{true};
+
+    /**
+     * If `true` then only the files changed since the last deploy (according
+     * to the ledger) and the files dependent on them are executed.
+     */
+    bool incremental{};
+
+    /**
+     * The maximum number of connections to use to execute the references
+     * marked as concurrent simultaneously.
+     */
+    std::size_t jobs{1};
+
+    /// If `true` then the index of the project tree is used.
+    bool tree_index{};
+
+    /// If `true` then the execution is profiled.
+    bool profile{};
+
+    /**
+     * If `true` then each batch is executed first by a single message, and
+     * only if it fails its queries are executed one by one.
+     */
+    bool optimistic{};
+
+    /**
+     * The size of the SQL files (in bytes) starting from which the files are
+     * executed in streaming mode. (Zero means never.)
+     */
+    std::uintmax_t stream_threshold{};
+
+    /// The format of the machine-readable diagnostics to save.
+    Diagnostics::Format diagnostics_format{Diagnostics::Format::text};
+
+    /**
+     * The maximum number of the parsed SQL files waiting for the execution,
+     * or zero to parse all of the SQL files of each reference before it's
+     * executed.
+     */
+    std::size_t queue_depth{};
+
+    /**
+     * If `true` then the queries are executed within the server by a single
+     * call of the function `spa_exec()` of the `dmitigr_spa` extension.
+     */
+    bool server_side{};
+
+    /**
+     * The timeouts of the queries of the SQL files for which no timeouts are
+     * specified in the per-directory configuration files.
+     */
+    Timeouts::Values timeouts;
+
+    /**
+     * The maximum number of the retries of the queries ended with the
+     * `lock_not_available` error (which is fatal when the retries are
+     * exhausted) per reference.
+     */
+    std::size_t lock_retries{3};
+
+    /**
+     * The base delay before the retry of the query ended with the
+     * `lock_not_available` error. The delay is doubled after each retry and
+     * randomized (between a half and the whole of it).
+     */
+    std::chrono::milliseconds lock_backoff{100};
+
+    /// The maximum duration of the execution (zero means unlimited).
+    std::chrono::seconds deadline{};
+
+    /**
+     * If `true` then the transactions on the targets are prepared (by using
+     * `PREPARE TRANSACTION`) and committed only if all of them are prepared.
+     */
+    bool two_phase{};
+  };
+
+  /// @brief The statistics of the execution.
+  struct Statistics final {
+    /// The number of sweeps of the parked queries back to the worklist.
+    std::size_t sweep_count{};
+
+    /// The number of attempts to execute the (non-empty) queries.
+    std::size_t attempt_count{};
+
+    /// The number of attempts ended with an error (excluding the ignored ones).
+    std::size_t failed_attempt_count{};
+
+    /// The number of attempts to execute the batches by a single message.
+    std::size_t optimistic_attempt_count{};
+
+    /// The number of attempts to execute the batches by a single message ended with an error.
+    std::size_t optimistic_failed_attempt_count{};
+
+    /// The number of retries of the queries ended with the `lock_not_available` error.
+    std::size_t lock_retry_count{};
+  };
+
+  /**
+   * @brief Executes the SQL batches in the same transaction.
+   *
+   * @param next_batches The function which returns the next portion of the
+   * batches to execute, or the empty vector if there are no more batches. The
+   * queries of each portion are pre-ordered and executed once as soon as the
+   * portion is returned, and the queries which failed are retried along with
+   * the queries of the subsequent portions. (Thus, the execution can start
+   * before all of the batches are loaded.) The batches are released as soon
+   * as all of their queries are executed.
+   * @param order The learned order of execution to replay. (Can be `nullptr`.)
+   * @param executed_keys The output parameter to store the keys of the queries
+   * in order of successful execution, if all of the queries are executed
+   * successfully. (Can be `nullptr`.)
+   * @param stats The output parameter to store the statistics of the
+   * execution. (Can be `nullptr`.)
+   * @param profile The profile to record the attempts to execute the queries
+   * to. (Can be `nullptr`.)
+   * @param parameters The values of the named parameters of the queries.
+   * (Can be `nullptr`.)
+   * @param diagnostics The diagnostics to record the errors to. (Can be `nullptr`.)
+   * @param timeouts The timeouts of the queries. (Can be `nullptr` in which
+   * case the timeouts of `options` are used.)
+   * @param canceller The canceller of the execution. (Can be `nullptr`.)
+   */
+  static std::size_t execute(pgfe::Connection* const conn,
+    const std::function<std::vector<Sql_batch>()>& next_batches, const Options& options,
+    const Execution_order* const order,
+    std::vector<Execution_order::Key>* const executed_keys,
+    Statistics* const stats = nullptr, Profile* const profile = nullptr,
+    Parameters* const parameters = nullptr, Diagnostics* const diagnostics = nullptr,
+    Timeouts* const timeouts = nullptr, const Canceller* const canceller = nullptr)
+  {
+    ASSERT_ALWAYS(conn);
+    ASSERT_ALWAYS(conn->is_transaction_block_uncommitted());
+
+    std::vector<Sql_batch> batches;
+    std::size_t successes_count{};
+    std::size_t total_count{};
+
+    const auto query_position = [](const auto* const err, const std::size_t query_offset)
+    {
+      std::optional<std::size_t> result;
+      if (const auto qp = err->query_position()) {
+        result = std::stoul(*qp);
+        ASSERT_ALWAYS(*result > query_offset);
+        *result -= query_offset;
+      }
+      return result;
+    };
+
+    /*
+     * The line indexes of the batches are built on demand (once per batch), so
+     * the locations of any number of the queries are found fast.
+     */
+    std::vector<std::optional<Line_index>> line_indexes;
+    const auto line_index = [&batches, &line_indexes](const std::size_t i) -> const Line_index&
+    {
+      if (!line_indexes[i])
+        line_indexes[i].emplace(batches[i].sql_vector()->to_string());
+      return *line_indexes[i];
+    };
+    /// @returns The number of the line of the beginning of the `j`-th query of the `i`-th batch.
+    const auto query_line = [&batches, &line_index](const std::size_t i, const std::size_t j)
+    {
+      const auto* const sql_vector = batches[i].sql_vector();
+      const auto qpos = sql_vector->query_absolute_position(j) +
+        str::position_of_non_space(sql_vector->sql_string(j)->to_query_string(), 0);
+      return line_index(i).line_column_numbers(qpos).first + 1;
+    };
+
+    const auto report_error = [&batches, &query_position, &line_index, diagnostics](const std::size_t i,
+      const std::size_t j, const auto* const err, const std::size_t query_offset)
+    {
+      ASSERT_ALWAYS(i < batches.size());
+      const auto* const sql_vector = batches[i].sql_vector();
+      ASSERT_ALWAYS(j < sql_vector->sql_string_count());
+      ASSERT_ALWAYS(!sql_vector->sql_string(j)->is_query_empty());
+      ASSERT_ALWAYS(err);
+      const auto qp = query_position(err, query_offset);
+      if (const auto& path = batches[i].path()) {
+        const auto ssp = sql_vector->query_absolute_position(j);
+        const auto qpos = qp ?
+          ssp + *qp :
+          ssp + str::position_of_non_space(sql_vector->sql_string(j)->to_query_string(), 0);
+        const auto[lnum, cnum] = line_index(i).line_column_numbers(qpos - 1);
+        report_file_error(*path, lnum + 1, cnum + 1, err, diagnostics);
+      } else {
+        const auto content = sql_vector->sql_string(j)->to_string();
+        const auto qpos = qp.value_or(1);
+        const auto[lnum, cnum] = Line_index{content}.line_column_numbers(qpos - 1);
+        if (diagnostics)
+          diagnostics->add({}, lnum + 1, cnum + 1, err, current_target_);
+        std::ostringstream message;
+        message << "pgspa internal query (see below):"
+                << lnum + 1 << ":" << cnum + 1 << ":Error: " << err->brief() << ":\n"
+                << content << "\n";
+        print_error(message.str());
+      }
+    };
+
+    /*
+     * In pipeline mode the rollback to the savepoint is postponed until the
+     * next message to the server, so the message consists of (optional)
+     * rollback command, the query and the savepoint command.
+     */
+    static const std::string rollback_command{"rollback to savepoint p1;\n"};
+    bool is_rollback_postponed{};
+    const auto rollback_to_savepoint = [&]
+    {
+      if (options.pipeline)
+        is_rollback_postponed = true;
+      else
+        conn->perform("rollback to savepoint p1");
+    };
+
+    /*
+     * The timeouts of the queries of each SQL file are set (by `SET LOCAL`)
+     * if they differ from the ones in effect. The savepoint is made right
+     * after that, so the rollbacks to the savepoint keep the timeouts in
+     * effect. The timeouts are reset after the successful execution.
+     */
+    Timeouts::Values applied_timeouts;
+    const auto apply_timeouts = [&](const Timeouts::Values& values)
+    {
+      if (values == applied_timeouts)
+        return;
+
+      std::string command;
+      if (is_rollback_postponed) {
+        command = rollback_command;
+        is_rollback_postponed = false;
+      }
+      for (const auto& [name, value] : {std::pair{"lock_timeout", &values.lock_timeout},
+          std::pair{"statement_timeout", &values.statement_timeout}}) {
+        command.append("set local ").append(name)
+          .append(*value ? " to " + conn->to_quoted_literal(**value) : std::string{" to default"})
+          .append(";\n");
+      }
+      conn->perform(command.append("savepoint p1"));
+      applied_timeouts = values;
+    };
+    const auto timeouts_of = [&](const std::size_t i) -> const Timeouts::Values&
+    {
+      const auto& path = batches[i].path();
+      return timeouts && path ? timeouts->values(*path) : options.timeouts;
+    };
+
+    /*
+     * The queries ended with the `lock_not_available` error are retried
+     * (within the budget) after the delays doubled after each retry and
+     * randomized to avoid the retries in lockstep with the other sessions.
+     * The failed query is rolled back before the delay, so its locks are
+     * released, but the locks acquired by the preceding queries of the
+     * transaction stay held until the end of the transaction.
+     */
+    std::minstd_rand random_engine{std::random_device{}()};
+    const auto lock_backoff = [&](const std::size_t retry)
+    {
+      const auto delay = (options.lock_backoff * (1 << std::min<std::size_t>(retry, 10))).count();
+      return std::chrono::milliseconds{std::uniform_int_distribution<decltype(delay)>{
+        delay / 2, delay}(random_engine)};
+    };
+
+    /*
+     * The sequence of the queries (pairs of indexes of the batch and of the
+     * query in the batch) in order of execution. The queries of each portion
+     * of the batches are pre-ordered by the static analysis of the
+     * dependencies between them (if enabled). Then the queries with known rank
+     * are placed first in order of their ranks, the rest are placed after them
+     * in the pre-defined order. The names of the objects created by the
+     * queries are used to wake up the queries waiting for these objects.
+     */
+    const auto root = (order || profile) ? Util::root_path() : filesystem::path{};
+    std::vector<std::vector<std::optional<Execution_order::Key>>> keys;
+    std::vector<std::pair<std::size_t, std::size_t>> sequence;
+    std::vector<std::vector<std::string>> created_names; // aligned with `sequence`
+    const auto append_sequence = [&](const std::size_t first_batch)
+    {
+      std::vector<std::pair<std::size_t, std::size_t>> portion;
+      for (std::size_t i = first_batch; i < batches.size(); ++i) {
+        if (order)
+          keys.push_back(Execution_order::keys(batches[i], root));
+        const auto sql_string_count = batches[i].sql_vector()->sql_string_count();
+        for (std::size_t j = 0; j < sql_string_count; ++j)
+          portion.emplace_back(i, j);
+      }
+
+      const auto reordered = [](auto vec, const std::vector<std::size_t>& indexes)
+      {
+        ASSERT(indexes.size() == vec.size());
+        decltype (vec) result;
+        result.reserve(vec.size());
+        for (const auto k : indexes)
+          result.push_back(std::move(vec[k]));
+        return result;
+      };
+
+      std::vector<Sql_analyzer::Objects> objects;
+      objects.reserve(portion.size());
+      for (const auto& [i, j] : portion) {
+        const auto* const sql_string = batches[i].sql_vector()->sql_string(j);
+        objects.push_back(sql_string->is_query_empty() ? Sql_analyzer::Objects{} :
+          Sql_analyzer::analyze(sql_string->to_query_string()));
+      }
+      if (options.analysis) {
+        const auto indexes = Sql_analyzer::sorted(objects);
+        portion = reordered(std::move(portion), indexes);
+        objects = reordered(std::move(objects), indexes);
+      }
+
+      if (order) {
+        /*
+         * The query without the rank (e.g. the edited one) keeps its natural
+         * position in its file: it's placed right after the ranked query
+         * preceding it in the same file (or right before the first ranked
+         * query of the file). Only the queries of the files without ranked
+         * queries are placed after all of the ranked ones.
+         */
+        using Position = std::tuple<std::size_t, int, std::size_t>; // rank, side, query index
+        std::vector<std::vector<std::optional<Position>>> positions(batches.size() - first_batch);
+        for (std::size_t i = first_batch; i < batches.size(); ++i) {
+          auto& batch_positions = positions[i - first_batch];
+          batch_positions.resize(keys[i].size());
+          std::optional<std::size_t> preceding;
+          for (std::size_t j = 0; j < keys[i].size(); ++j) {
+            if (const auto rank = keys[i][j] ? order->rank(*keys[i][j]) : std::nullopt) {
+              preceding = rank;
+              batch_positions[j] = Position{*rank, 0, j};
+            } else if (preceding)
+              batch_positions[j] = Position{*preceding, 1, j};
+          }
+          std::optional<std::size_t> following;
+          for (auto j = keys[i].size(); j-- > 0;) {
+            if (batch_positions[j] && !std::get<1>(*batch_positions[j]))
+              following = std::get<0>(*batch_positions[j]);
+            else if (!batch_positions[j] && following)
+              batch_positions[j] = Position{*following, -1, j};
+          }
+        }
+        std::vector<const std::optional<Position>*> ranks;
+        ranks.reserve(portion.size());
+        for (const auto& [i, j] : portion)
+          ranks.push_back(&positions[i - first_batch][j]);
+
+        std::vector<std::size_t> indexes(portion.size());
+        for (std::size_t k = 0; k < indexes.size(); ++k)
+          indexes[k] = k;
+        std::stable_sort(begin(indexes), end(indexes), [&ranks](const auto lhs, const auto rhs)
+        {
+          const auto& l = *ranks[lhs];
+          const auto& r = *ranks[rhs];
+          return l && (!r || *l < *r);
+        });
+        portion = reordered(std::move(portion), indexes);
+        objects = reordered(std::move(objects), indexes);
+      }
+
+      sequence.insert(cend(sequence), cbegin(portion), cend(portion));
+      created_names.reserve(sequence.size());
+      for (auto& o : objects)
+        created_names.push_back(std::move(o.created));
+    };
+
+    /*
+     * The locations of the queries (aligned with the `sequence`) and the
+     * numbers of the attempts to execute them are only needed for profiling.
+     */
+    std::vector<std::string> locations;
+    std::vector<std::size_t> attempts;
+    const auto append_locations = [&]
+    {
+      locations.reserve(sequence.size());
+      for (auto k = locations.size(); k < sequence.size(); ++k) {
+        const auto [i, j] = sequence[k];
+        const auto& path = batches[i].path();
+        locations.push_back((path ? Util::project_path(*path, root) : std::string{"<internal>"})
+          + ":" + std::to_string(query_line(i, j)));
+      }
+      attempts.resize(sequence.size());
+    };
+
+    // The keys of the queries in order of successful execution.
+    std::vector<Execution_order::Key> learned_keys;
+    const auto learn = [&](const std::size_t i, const std::size_t j)
+    {
+      if (order && keys[i][j])
+        learned_keys.push_back(*keys[i][j]);
+    };
+
+    /*
+     * The queries are executed by using the worklist scheduler. Initially all
+     * the queries are ready to execute in the order of the `sequence`. A query
+     * ended with a non-fatal error is parked on the wait list keyed by the
+     * name of the missing object (if the name can be extracted from the error
+     * message), and is woken up only when a query which creates the object
+     * with such a name is successfully executed. When there are no ready
+     * queries but there were successfully executed queries since the last
+     * sweep, all of the parked queries are swept back to the worklist (since
+     * the missing objects could be created implicitly), which corresponds to
+     * the next iteration of the classic iterative algorithm.
+     */
+    std::deque<std::size_t> ready; // indexes of `sequence`
+    std::unordered_map<std::string, std::vector<std::size_t>> waiting;
+    std::vector<std::size_t> parked; // without the name of the missing object
+
+    const auto park = [&](const std::size_t k, const std::string& error_message)
+    {
+      if (auto name = Sql_analyzer::missing_object_name(error_message))
+        waiting[std::move(*name)].push_back(k);
+      else
+        parked.push_back(k);
+    };
+    const auto wake_up = [&](const std::size_t k)
+    {
+      for (const auto& name : created_names[k]) {
+        if (const auto w = waiting.find(name); w != cend(waiting)) {
+          ready.insert(cend(ready), cbegin(w->second), cend(w->second));
+          waiting.erase(w);
+        }
+      }
+    };
+    const auto sweep = [&]
+    {
+      for (auto& w : waiting)
+        parked.insert(cend(parked), cbegin(w.second), cend(w.second));
+      waiting.clear();
+      std::sort(begin(parked), end(parked));
+      ready.insert(cend(ready), cbegin(parked), cend(parked));
+      parked.clear();
+    };
+
+    /*
+     * The state of the execution is kept in the flat arrays aligned with the
+     * `sequence`. Only the last error of each query is retained. The error is
+     * retained by the reference to the thrown exception, so retaining it
+     * requires no copying of the error.
+     */
+    std::vector<std::exception_ptr> errors;
+    std::vector<std::size_t> query_offsets;
+
+    /*
+     * The numbers of the queries of the batches which are not executed yet.
+     * The batches without such queries are released after each portion.
+     */
+    std::vector<std::size_t> pending_counts;
+    std::vector<std::size_t> completed_batches;
+
+    std::size_t sweep_successes_count{};
+    std::string message; // the buffer of the message in pipeline mode
+    Statistics statistics;
+    Profile::Clock::time_point attempt_start;
+    const auto record = [&](const std::size_t k, const Profile::Outcome outcome,
+      const std::string& sqlstate = {})
+    {
+      if (profile)
+        profile->attempt(locations[k], ++attempts[k], statistics.sweep_count, outcome,
+          sqlstate, attempt_start);
+    };
+    const auto done = [&](const std::size_t k)
+    {
+      const auto [i, j] = sequence[k];
+      errors[k] = nullptr;
+      ++sweep_successes_count;
+      learn(i, j);
+      wake_up(k);
+      if (!--pending_counts[i])
+        completed_batches.push_back(i);
+    };
+
+    /*
+     * The queries with the named parameters are executed as the prepared
+     * statements, except the utility statements, which cannot be prepared.
+     * The values of the parameters referenced like `:'name'` and `:"name"`
+     * are substituted into the queries as the quoted literals and identifiers
+     * (like `psql` does), and the references like `:name` are not allowed in
+     * the utility statements. The prepared statements are named by the hashes
+     * of the query strings and are looked up on the connection, so each
+     * distinct query is prepared once per connection (rather than once per
+     * call) and the statements are reused by the subsequent calls on the same
+     * connection (e.g. by the re-executions in watch and server modes).
+     */
+    const auto parameter_value = [&](const std::size_t i,
+      const std::string& name) -> const std::optional<std::string>&
+    {
+      ASSERT(parameters);
+      const auto& path = batches[i].path();
+      const auto& values = parameters->values(path ? *path : Util::root_path() / "-");
+      if (const auto v = values.find(name); v != cend(values))
+        return v->second;
+      else
+        throw std::runtime_error{"no value of the parameter \"" + name + "\" specified" +
+          (path ? " (required by " + path->string() + ")" : std::string{})};
+    };
+    const auto is_parameterized = [&](const pgfe::Sql_string* const sql_string)
+    {
+      return parameters && (sql_string->has_named_parameters() ||
+        with_quoted_parameters(sql_string->to_query_string(),
+          [](const std::string&, bool) { return std::string{}; }));
+    };
+    const auto with_quoted_values = [&](const std::size_t i, const std::string_view query)
+    {
+      return with_quoted_parameters(query, [&](const std::string& name, const bool is_identifier)
+      {
+        const auto& value = parameter_value(i, name);
+        if (!value && is_identifier) {
+          const auto& path = batches[i].path();
+          throw std::runtime_error{"the value of the parameter \"" + name + "\" used as identifier is NULL" +
+            (path ? " (in " + path->string() + ")" : std::string{})};
+        }
+        return !value ? std::string{"NULL"} : is_identifier ?
+          conn->to_quoted_identifier(*value) : conn->to_quoted_literal(*value);
+      });
+    };
+    /// @returns The `sql_string` with the values of all of its parameters substituted.
+    const auto substituted = [&](const std::size_t i, const pgfe::Sql_string* const sql_string)
+    {
+      const auto query = sql_string->to_query_string();
+      const auto quoted = with_quoted_values(i, query);
+      auto result = quoted ? pgfe::Sql_string::make(*quoted) : sql_string->to_sql_string();
+      if (result->has_named_parameters() && is_utility(query)) {
+        const auto& path = batches[i].path();
+        throw std::runtime_error{"the parameters of the utility statement must be referenced"
+          " like :'name' (literal) or :\"name\" (identifier)" +
+          (path ? " (in " + path->string() + ")" : std::string{})};
+      }
+      for (std::size_t p = 0; p < result->parameter_count(); ++p) {
+        if (const auto name = result->parameter_name(p); !name.empty()) {
+          const auto& value = parameter_value(i, name);
+          const auto text = pgfe::Sql_string::make(value ? conn->to_quoted_literal(*value) : "NULL");
+          result->replace_parameter(name, text.get());
+        }
+      }
+      return result;
+    };
+    const auto execute_parameterized = [&](const std::size_t i, const pgfe::Sql_string* sql_string)
+    {
+      ASSERT(parameters);
+      auto query = sql_string->to_query_string();
+      if (is_utility(query)) {
+        conn->execute(substituted(i, sql_string).get());
+      } else {
+        std::unique_ptr<pgfe::Sql_string> quoted_sql_string;
+        if (auto quoted = with_quoted_values(i, query)) {
+          quoted_sql_string = pgfe::Sql_string::make(*quoted);
+          sql_string = quoted_sql_string.get();
+          query = std::move(*quoted);
+        }
+        const auto name = "pgspa_" + Util::hex(Util::hash(query));
+        auto* ps = conn->prepared_statement(name);
+        if (!ps)
+          ps = conn->prepare_statement(sql_string, name);
+        ASSERT(ps);
+        for (std::size_t p = 0; p < sql_string->parameter_count(); ++p) {
+          if (const auto& name = sql_string->parameter_name(p); !name.empty())
+            ps->set_parameter(name, parameter_value(i, name));
+        }
+        ps->execute();
+      }
+      conn->complete();
+    };
+
+    /*
+     * The `COPY ... FROM STDIN` queries are executed by `copy_in()`, and their
+     * data is sent right from the content of the batch (or from the companion
+     * file, by chunks).
+     */
+    const auto execute_copy = [&](const std::size_t i, const pgfe::Sql_string* const sql_string,
+      const Sql_batch::Copy_data& data)
+    {
+      const auto query = is_parameterized(sql_string) ?
+        substituted(i, sql_string)->to_query_string() : sql_string->to_query_string();
+      copy_in(conn, query, canceller, [&data](const auto& put)
+      {
+        if (data.companion)
+          Util::read_file(*data.companion, put);
+        else
+          put(data.content);
+      });
+    };
+
+    /*
+     * In optimistic mode each batch is executed first by a single message,
+     * in order of the first occurrence of its queries in the `sequence`. If
+     * the batch fails it's rolled back and its queries are executed by the
+     * worklist scheduler one by one, as usual, to classify the errors and to
+     * report them precisely. (The batches with the parameterized queries or
+     * with the `COPY ... FROM STDIN` queries are always executed by the
+     * worklist scheduler.)
+     */
+    const auto execute_optimistically = [&](const std::size_t first_batch, const std::size_t first_query)
+    {
+      std::vector<std::vector<std::size_t>> positions(batches.size() - first_batch); // of queries in `sequence`
+      std::vector<std::size_t> batch_order;
+      std::vector<bool> is_ordered(positions.size());
+      for (std::size_t i = first_batch; i < batches.size(); ++i)
+        positions[i - first_batch].resize(batches[i].sql_vector()->sql_string_count());
+      for (std::size_t k = first_query; k < sequence.size(); ++k) {
+        const auto [i, j] = sequence[k];
+        positions[i - first_batch][j] = k;
+        if (!is_ordered[i - first_batch] && !batches[i].sql_vector()->sql_string(j)->is_query_empty()) {
+          is_ordered[i - first_batch] = true;
+          batch_order.push_back(i);
+        }
+      }
+      batch_order.erase(std::remove_if(begin(batch_order), end(batch_order), [&](const std::size_t i)
+      {
+        if (batches[i].has_copy_data())
+          return true;
+        const auto* const sql_vector = batches[i].sql_vector();
+        for (std::size_t j = 0; j < sql_vector->sql_string_count(); ++j) {
+          if (is_parameterized(sql_vector->sql_string(j)))
+            return true;
+        }
+        return false;
+      }), end(batch_order));
+
+      std::vector<bool> is_batch_done(positions.size());
+      for (const auto i : batch_order) {
+        if (canceller)
+          canceller->check();
+        apply_timeouts(timeouts_of(i));
+        const auto* const sql_vector = batches[i].sql_vector();
+        message.clear();
+        if (is_rollback_postponed) {
+          message = rollback_command;
+          is_rollback_postponed = false;
+        }
+        for (std::size_t j = 0; j < sql_vector->sql_string_count(); ++j) {
+          if (const auto* const sql_string = sql_vector->sql_string(j); !sql_string->is_query_empty())
+            message.append(sql_string->to_query_string()).append("\n;\n");
+        }
+        message.append("savepoint p1");
+
+        ++statistics.optimistic_attempt_count;
+        if (profile)
+          attempt_start = Profile::Clock::now();
+        try {
+          conn->perform(message);
+          is_batch_done[i - first_batch] = true;
+        } catch (const pgfe::Server_exception&) {
+          ++statistics.optimistic_failed_attempt_count;
+          rollback_to_savepoint();
+        }
+        if (profile) {
+          const auto& path = batches[i].path();
+          profile->attempt(path ? Util::project_path(*path, root) : std::string{"<internal>"}, 1, 0,
+            is_batch_done[i - first_batch] ? Profile::Outcome::success : Profile::Outcome::failure,
+            {}, attempt_start);
+        }
+        if (is_batch_done[i - first_batch]) {
+          for (std::size_t j = 0; j < sql_vector->sql_string_count(); ++j) {
+            if (!sql_vector->sql_string(j)->is_query_empty())
+              done(positions[i - first_batch][j]);
+          }
+        }
+      }
+
+      ready.erase(std::remove_if(begin(ready), end(ready), [&](const std::size_t k)
+      {
+        const auto i = sequence[k].first;
+        return i >= first_batch && is_batch_done[i - first_batch];
+      }), end(ready));
+    };
+
+    /*
+     * Executes the ready queries until there are no more of them.
+     *
+     * @returns `false` if a query ended with the fatal error.
+     */
+    const auto execute_ready = [&]
+    {
+      while (!ready.empty()) {
+        const auto k = ready.front();
+        ready.pop_front();
+        const auto [i, j] = sequence[k];
+        const auto* const sql_string = batches[i].sql_vector()->sql_string(j);
+        if (sql_string->is_query_empty())
+          continue; // short-circuit an empty query execution
+
+        if (canceller)
+          canceller->check();
+        apply_timeouts(timeouts_of(i));
+        std::size_t query_offset{};
+        ++statistics.attempt_count;
+        if (profile)
+          attempt_start = Profile::Clock::now();
+
+        /*
+         * Handles the error `e` (described by `err`) of the query.
+         *
+         * @returns `false` if the error is fatal.
+         */
+        const auto handle_error = [&](const auto& e, const auto* const err)
+        {
+          if (is_ignorable(e)) {
+            rollback_to_savepoint();
+            record(k, Profile::Outcome::ignored, err->sqlstate());
+            done(k);
+          } else if (is_lock_not_available(e) && statistics.lock_retry_count < options.lock_retries) {
+            ++statistics.failed_attempt_count;
+            errors[k] = std::current_exception(); // error (hope for the lock release)
+            query_offsets[k] = query_offset;
+            rollback_to_savepoint();
+            if (is_rollback_postponed) {
+              conn->perform(rollback_command); // release the locks of the query before the backoff
+              is_rollback_postponed = false;
+            }
+            record(k, Profile::Outcome::failure, err->sqlstate());
+            if (const auto delay = lock_backoff(statistics.lock_retry_count++); canceller)
+              canceller->sleep_for(delay);
+            else
+              std::this_thread::sleep_for(delay);
+            ready.push_front(k);
+          } else if (is_non_fatal(e)) {
+            ++statistics.failed_attempt_count;
+            errors[k] = std::current_exception(); // error (hope for the wake up)
+            query_offsets[k] = query_offset;
+            rollback_to_savepoint();
+            record(k, Profile::Outcome::failure, err->sqlstate());
+            park(k, err->brief());
+          } else {
+            ++statistics.failed_attempt_count;
+            errors[k] = std::current_exception(); // fatal error (which will be reported last)
+            query_offsets[k] = query_offset;
+            record(k, Profile::Outcome::fatal, err->sqlstate());
+            return false;
+          }
+          return true;
+        };
+
+        try {
+          const auto* const copy = batches[i].copy_data(j);
+          if (copy || is_parameterized(sql_string)) {
+            if (is_rollback_postponed) {
+              conn->perform(rollback_command);
+              is_rollback_postponed = false;
+            }
+            if (copy)
+              execute_copy(i, sql_string, *copy);
+            else
+              execute_parameterized(i, sql_string);
+            conn->perform("savepoint p1");
+          } else if (options.pipeline) {
+            message.clear();
+            if (is_rollback_postponed) {
+              message = rollback_command;
+              query_offset = message.size();
+              is_rollback_postponed = false;
+            }
+            message.append(sql_string->to_query_string()).append("\n;savepoint p1");
+            conn->perform(message);
+          } else {
+            conn->execute(sql_string);
+            conn->complete();
+            conn->perform("savepoint p1");
+          }
+          record(k, Profile::Outcome::success);
+          done(k);
+        } catch (const pgfe::Server_exception& e) {
+          if (!handle_error(e, e.error()))
+            return false;
+        } catch (const Copy_error& e) {
+          if (!handle_error(e, &e))
+            return false;
+        }
+      }
+      return true;
+    };
+
+    /*
+     * In server-side mode all of the queries are sent to the function
+     * `spa_exec()` of the `dmitigr_spa` extension by a single call, which
+     * executes them by the same iterative algorithm within the server. (The
+     * values of the named parameters are substituted into the queries as the
+     * literals or identifiers.) Since the positions of the errors are not available within
+     * the server, each query which failed is executed once again (and rolled
+     * back) in order to report its error precisely.
+     */
+    if (options.server_side) {
+      for (auto portion = next_batches(); !portion.empty(); portion = next_batches()) {
+        for (auto& batch : portion) {
+          total_count += batch.sql_vector()->non_empty_count();
+          batches.push_back(std::move(batch));
+        }
+      }
+      line_indexes.resize(batches.size());
+      append_sequence(0);
+      errors.resize(sequence.size());
+      query_offsets.resize(sequence.size());
+
+      std::vector<std::size_t> queries; // indexes of `sequence` of the non-empty queries
+      for (std::size_t k = 0; k < sequence.size(); ++k) {
+        const auto [i, j] = sequence[k];
+        if (batches[i].copy_data(j))
+          throw std::runtime_error{batches[i].path()->string() + ":" + std::to_string(query_line(i, j)) +
+            ": COPY ... FROM STDIN cannot be executed in server-side mode"};
+        else if (!batches[i].sql_vector()->sql_string(j)->is_query_empty())
+          queries.push_back(k);
+      }
+      if (queries.empty())
+        goto finish;
+
+      std::optional<std::string> function;
+      conn->execute("select quote_ident(n.nspname)||'.spa_exec'"
+        " from pg_catalog.pg_extension e"
+        " join pg_catalog.pg_namespace n on (n.oid = e.extnamespace)"
+        " where e.extname = 'dmitigr_spa' and"
+        " pg_catalog.to_regprocedure(quote_ident(n.nspname)||'.spa_exec(text[])') is not null");
+      conn->for_each([&function](const pgfe::Row* const r)
+      {
+        function = pgfe::to<std::string>(r->data(0));
+      });
+      if (!function)
+        throw std::runtime_error{"the function spa_exec() of the extension dmitigr_spa"
+          " is not available in the database"};
+
+      const auto query_string = [&](const std::size_t k)
+      {
+        const auto [i, j] = sequence[k];
+        const auto* const sql_string = batches[i].sql_vector()->sql_string(j);
+        if (is_parameterized(sql_string))
+          return substituted(i, sql_string)->to_query_string();
+        else
+          return sql_string->to_query_string();
+      };
+      std::string call{"select statement_index, is_done, coalesce(execution_number, 0), attempt_count,"
+        " coalesce(error_sqlstate, ''), coalesce(error_message, '')"
+        " from " + *function + "(array["};
+      for (std::size_t q = 0; q < queries.size(); ++q)
+        call.append(q ? ",\n" : "").append(conn->to_quoted_literal(query_string(queries[q])));
+      call.append("]::text[])");
+
+      struct Result final {
+        bool is_done{};
+        std::size_t execution_number{};
+        std::size_t attempt_count{};
+        std::string error_sqlstate;
+        std::string error_message;
+      };
+      std::vector<Result> results(queries.size());
+      if (canceller)
+        canceller->check();
+      apply_timeouts(options.timeouts);
+      const auto execution_start = Profile::Clock::now();
+      conn->execute(call);
+      conn->for_each([&results](const pgfe::Row* const r)
+      {
+        const auto q = pgfe::to<int>(r->data(0));
+        ASSERT_ALWAYS(q >= 1 && static_cast<std::size_t>(q) <= results.size());
+        results[q - 1] = {pgfe::to<bool>(r->data(1)),
+          static_cast<std::size_t>(pgfe::to<int>(r->data(2))),
+          static_cast<std::size_t>(pgfe::to<int>(r->data(3))),
+          pgfe::to<std::string>(r->data(4)), pgfe::to<std::string>(r->data(5))};
+      });
+      if (profile)
+        profile->phase("server-side execution", execution_start);
+
+      std::vector<std::pair<std::size_t, std::size_t>> executed; // (execution number, index of `sequence`)
+      for (std::size_t q = 0; q < queries.size(); ++q) {
+        const auto k = queries[q];
+        const auto& result = results[q];
+        statistics.attempt_count += result.attempt_count;
+        statistics.sweep_count = std::max(statistics.sweep_count, result.attempt_count);
+        if (result.is_done) {
+          statistics.failed_attempt_count += result.attempt_count - 1;
+          ++successes_count;
+          executed.emplace_back(result.execution_number, k);
+        } else if (result.attempt_count) {
+          statistics.failed_attempt_count += result.attempt_count;
+          conn->perform("savepoint p1");
+          try {
+            conn->execute(query_string(k));
+            conn->complete();
+          } catch (const pgfe::Server_exception&) {
+            errors[k] = std::current_exception();
+          }
+          conn->perform("rollback to savepoint p1");
+
+          // The error may not be reproduced (e.g. the lock is already released).
+          if (!errors[k]) {
+            const auto [i, j] = sequence[k];
+            const auto& path = batches[i].path();
+            print_error((path ? path->string() : std::string{"pgspa internal query"}) + ":" +
+              std::to_string(query_line(i, j)) + ":Error: " + result.error_message +
+              " (SQLSTATE " + result.error_sqlstate + ")\n");
+          }
+        }
+      }
+      std::sort(begin(executed), end(executed));
+      for (const auto& e : executed)
+        learn(sequence[e.second].first, sequence[e.second].second);
+      goto finish;
+    }
+
+    /*
+     * The first sweep consists of the executions of the portions of the
+     * batches. The queries of each portion are executed as soon as the
+     * portion is available, and the queries parked in the meantime wait for
+     * the queries of the subsequent portions as usual.
+     */
+    conn->perform("savepoint p1");
+    ++statistics.sweep_count;
+    while (true) {
+      auto portion = next_batches();
+      if (portion.empty())
+        break;
+
+      const auto analysis_start = Profile::Clock::now();
+      const auto first_batch = batches.size();
+      const auto first_query = sequence.size();
+      for (auto& batch : portion) {
+        const auto count = batch.sql_vector()->non_empty_count();
+        total_count += count;
+        pending_counts.push_back(count);
+        if (!count)
+          completed_batches.push_back(batches.size());
+        batches.push_back(std::move(batch));
+      }
+      line_indexes.resize(batches.size());
+      append_sequence(first_batch);
+      if (profile) {
+        profile->phase("analysis", analysis_start);
+        append_locations();
+      }
+      errors.resize(sequence.size());
+      query_offsets.resize(sequence.size());
+      for (auto k = first_query; k < sequence.size(); ++k)
+        ready.push_back(k);
+
+      if (options.optimistic)
+        execute_optimistically(first_batch, first_query);
+      if (!execute_ready())
+        goto finish;
+
+      // The executed batches are no longer needed.
+      static const Sql_batch released{pgfe::Sql_vector::make()};
+      for (const auto i : completed_batches) {
+        batches[i] = released;
+        line_indexes[i].reset();
+      }
+      completed_batches.clear();
+    }
+
+    while (true) {
+      successes_count += sweep_successes_count;
+      if (!sweep_successes_count || successes_count == total_count)
+        break;
+      sweep_successes_count = 0;
+      sweep();
+      ++statistics.sweep_count;
+      if (!execute_ready())
+        goto finish;
+    }
+
+    if (is_rollback_postponed)
+      conn->perform("rollback to savepoint p1");
+
+  finish:
+    if (stats)
+      *stats = statistics;
+    if (profile)
+      profile->add_sweeps(statistics.sweep_count);
+
+    /*
+     * If there are queries, which was not executed without errors
+     * it's necessary to report about them and to throw an exception.
+     */
+    if (successes_count < total_count) {
+      std::vector<std::size_t> failed;
+      for (std::size_t k = 0; k < errors.size(); ++k) {
+        if (errors[k])
+          failed.push_back(k);
+      }
+      std::sort(begin(failed), end(failed), [&sequence](const auto lhs, const auto rhs)
+      {
+        return sequence[lhs] < sequence[rhs];
+      });
+      for (const auto k : failed) {
+        try {
+          std::rethrow_exception(errors[k]);
+        } catch (const pgfe::Server_exception& e) {
+          report_error(sequence[k].first, sequence[k].second, e.error(), query_offsets[k]);
+        } catch (const Copy_error& e) {
+          // The error in the data is reported at the erroneous line of the data.
+          const auto [i, j] = sequence[k];
+          const auto* const copy = batches[i].copy_data(j);
+          if (const auto line = e.data_line(); line && copy) {
+            if (copy->companion)
+              report_file_error(*copy->companion, *line, 1, &e, diagnostics);
+            else
+              report_file_error(*batches[i].path(), copy->line + *line - 1, 1, &e, diagnostics);
+          } else
+            report_error(i, j, &e, query_offsets[k]);
+        }
+      }
+      throw Handled_exception{};
+    }
+
+    if (applied_timeouts != Timeouts::Values{})
+      conn->perform("set local lock_timeout to default; set local statement_timeout to default");
+
+    if (executed_keys)
+      executed_keys->insert(cend(*executed_keys), std::make_move_iterator(begin(learned_keys)),
+        std::make_move_iterator(end(learned_keys)));
+
+    return total_count;
+  }
+
+  /// @overload
+  static std::size_t execute(pgfe::Connection* const conn,
+    const std::vector<Sql_batch>& batches, const Options& options,
+    const Execution_order* const order,
+    std::vector<Execution_order::Key>* const executed_keys,
+    Statistics* const stats = nullptr, Profile* const profile = nullptr,
+    Parameters* const parameters = nullptr, Diagnostics* const diagnostics = nullptr,
+    Timeouts* const timeouts = nullptr, const Canceller* const canceller = nullptr)
+  {
+    bool is_returned{};
+    return execute(conn, [&batches, &is_returned]
+    {
+      std::vector<Sql_batch> result;
+      if (!is_returned) {
+        result = batches;
+        is_returned = true;
+      }
+      return result;
+    }, options, order, executed_keys, stats, profile, parameters, diagnostics, timeouts,
+      canceller);
+  }
+
+  /**
+   * @brief Executes the queries of the SQL file at `path` in the current
+   * transaction in order of their appearance, without loading the whole file
+   * into memory.
+   *
+   * The queries are sent in messages of the limited size. If the message
+   * fails, it's rolled back and its queries are executed one by one: the
+   * queries ended with the ignorable errors are skipped, and any other error
+   * is fatal (since the queries cannot be retained to retry them later).
+   * The `COPY ... FROM STDIN` queries are executed by `copy_in()` right after
+   * the preceding queries, and their data is streamed right from the read
+   * buffer (or from the companion file). Any error of them is fatal.
+   *
+   * @returns The number of the executed queries.
+   */
+  static std::size_t execute_stream(pgfe::Connection* const conn,
+    const filesystem::path& path, Profile* const profile = nullptr,
+    Diagnostics* const diagnostics = nullptr, const Canceller* const canceller = nullptr)
+  {
+    ASSERT_ALWAYS(conn);
+    ASSERT_ALWAYS(conn->is_transaction_block_uncommitted());
+
+    constexpr std::size_t message_size_limit{1024 * 1024};
+    const auto root = profile ? Util::root_path() : filesystem::path{};
+    Sql_stream stream{path};
+    std::vector<Sql_stream::Query> queries;
+    std::size_t queries_size{};
+    std::size_t count{};
+    std::string message;
+
+    const auto report_error = [&path, diagnostics](const Sql_stream::Query& query, const auto* const err)
+    {
+      auto lnum = query.line, cnum = query.column;
+      if (const auto qp = err->query_position()) {
+        const auto qpos = std::min<std::size_t>(std::stoul(*qp), query.text.size() + 1);
+        for (std::size_t p = 0; p + 1 < qpos; ++p) {
+          if (query.text[p] == '\n') {
+            ++lnum;
+            cnum = 1;
+          } else
+            ++cnum;
+        }
+      }
+      report_file_error(path, lnum, cnum, err, diagnostics);
+    };
+
+    const auto send = [&]
+    {
+      if (queries.empty())
+        return;
+
+      if (canceller)
+        canceller->check();
+      const auto start = Profile::Clock::now();
+      message.clear();
+      for (const auto& query : queries)
+        message.append(query.text).append("\n;\n");
+      message.append("savepoint p1");
+      try {
+        conn->perform(message);
+      } catch (const pgfe::Server_exception&) {
+        conn->perform("rollback to savepoint p1");
+        for (const auto& query : queries) {
+          try {
+            conn->perform(query.text);
+            conn->perform("savepoint p1");
+          } catch (const pgfe::Server_exception& e) {
+            if (is_ignorable(e))
+              conn->perform("rollback to savepoint p1");
+            else {
+              report_error(query, e.error());
+              throw Handled_exception{};
+            }
+          }
+        }
+      }
+      if (profile)
+        profile->attempt(Util::project_path(path, root) + ":" + std::to_string(queries.front().line),
+          1, 0, Profile::Outcome::success, {}, start);
+
+      count += queries.size();
+      queries.clear();
+      queries_size = 0;
+    };
+
+    const auto companion = Sql_batch::companion_path(path);
+    bool is_companion_used{};
+    const auto copy = [&](const Sql_stream::Query& query)
+    {
+      if (companion) {
+        if (is_companion_used)
+          throw std::runtime_error{path.string() + ":" + std::to_string(query.line) +
+            ": only one COPY ... FROM STDIN can take the data from the file \"" +
+            companion->string() + "\""};
+        is_companion_used = true;
+      }
+
+      // The data follows the line on which the query is ended.
+      const auto data_line = query.line + std::count(cbegin(query.text), cend(query.text), '\n') + 1;
+      if (canceller)
+        canceller->check();
+      const auto start = Profile::Clock::now();
+      try {
+        copy_in(conn, query.text, canceller, [&](const auto& put)
+        {
+          if (companion)
+            Util::read_file(*companion, put);
+          else
+            stream.read_copy_data(put);
+        });
+        conn->perform("savepoint p1");
+      } catch (const Copy_error& e) {
+        if (const auto line = e.data_line())
+          report_file_error(companion ? *companion : path, companion ? *line : data_line + *line - 1, 1,
+            &e, diagnostics);
+        else
+          report_error(query, &e);
+        throw Handled_exception{};
+      }
+      if (profile)
+        profile->attempt(Util::project_path(path, root) + ":" + std::to_string(query.line),
+          1, 0, Profile::Outcome::success, {}, start);
+      ++count;
+    };
+
+    conn->perform("savepoint p1");
+    while (auto query = stream.next()) {
+      if (Sql_stream::is_copy_from_stdin(query->text)) {
+        send();
+        copy(*query);
+        continue;
+      }
+
+      queries_size += query->text.size();
+      queries.push_back(std::move(*query));
+      if (queries_size >= message_size_limit)
+        send();
+    }
+    send();
+    return count;
+  }
+
+private:
+  std::vector<std::string> args_;
+  Options options_;
+  Parameters::Values parameters_;
+  Batch_cache* cache_{};
+  inline static thread_local std::string current_target_; // the name of the target being executed on
+  std::vector<std::string> server_args_;
+  std::vector<std::unique_ptr<Exec>> targets_;
+  filesystem::path bundle_;
+
+  /**
+   * @brief Executes the `COPY ... FROM STDIN` `query` by using the COPY
+   * sub-protocol of libpq directly (since pgfe doesn't implement it).
+   *
+   * The data is passed by `produce(put)`, where `put(std::string_view)` sends
+   * the part of the data right from the buffer of the caller (in messages of
+   * the limited size). The sending is stopped if the execution is cancelled
+   * by `canceller` (which can be `nullptr`).
+   *
+   * @throws `Copy_error` if the query failed.
+   */
+  template<typename F>
+  static void copy_in(pgfe::Connection* const conn, const std::string& query,
+    const Canceller* const canceller, F&& produce)
+  {
+    ASSERT_ALWAYS(conn);
+    auto* const handle = conn->native_handle();
+    ASSERT_ALWAYS(handle);
+    const auto failure = [handle](const std::string& what)
+    {
+      return std::runtime_error{what + ": " + PQerrorMessage(handle)};
+    };
+
+    // The data is sent in blocking mode (the mode of pgfe is restored then).
+    struct Blocking_mode final {
+      PGconn* const handle;
+      const bool was_nonblocking;
+      ~Blocking_mode()
+      {
+        if (was_nonblocking)
+          PQsetnonblocking(handle, 1);
+      }
+    } const blocking_mode{handle, PQisnonblocking(handle) == 1};
+    if (blocking_mode.was_nonblocking && PQsetnonblocking(handle, 0))
+      throw failure("cannot switch the connection to blocking mode");
+
+    using Result = std::unique_ptr<PGresult, decltype(&PQclear)>;
+    if (const Result result{PQexec(handle, query.c_str()), &PQclear}; !result)
+      throw failure("cannot execute COPY");
+    else if (PQresultStatus(result.get()) == PGRES_FATAL_ERROR)
+      throw Copy_error{result.get()};
+    else if (PQresultStatus(result.get()) != PGRES_COPY_IN)
+      throw std::runtime_error{"the query is not COPY ... FROM STDIN:\n" + query};
+
+    /*
+     * The data is sent until the producer is done, fails (in which case COPY
+     * is ended with an error), or until the server rejects the data (in which
+     * case its error is taken from the results).
+     */
+    struct Rejection final {};
+    std::exception_ptr producer_error;
+    bool is_rejected{};
+    try {
+      produce([handle, canceller](std::string_view data)
+      {
+        constexpr std::size_t message_size_limit{1024 * 1024};
+        while (!data.empty()) {
+          const auto size = std::min(data.size(), message_size_limit);
+          if (PQputCopyData(handle, data.data(), static_cast<int>(size)) != 1)
+            throw Rejection{};
+          data.remove_prefix(size);
+          if (canceller)
+            canceller->check();
+        }
+      });
+    } catch (const Rejection&) {
+      is_rejected = true;
+    } catch (...) {
+      producer_error = std::current_exception();
+    }
+    if (!is_rejected && PQputCopyEnd(handle, producer_error ? "interrupted by pgspa" : nullptr) != 1)
+      throw failure("cannot end COPY");
+
+    std::optional<Copy_error> error;
+    bool is_completed{};
+    while (const Result result{PQgetResult(handle), &PQclear}) {
+      const auto status = PQresultStatus(result.get());
+      if (status == PGRES_COMMAND_OK)
+        is_completed = true;
+      else if (status == PGRES_FATAL_ERROR && !error)
+        error.emplace(result.get());
+      else if (status == PGRES_COPY_IN)
+        throw failure("cannot send the data of COPY");
+    }
+    if (producer_error)
+      std::rethrow_exception(producer_error);
+    else if (error)
+      throw std::move(*error);
+    else if (!is_completed)
+      throw failure("COPY failed");
+  }
+
+  /**
+   * @brief Executes the references of the bundle (all of them, or only the
+   * ones specified as the arguments) without touching the project tree.
+   */
+  void run_bundle(const Canceller& canceller)
+  {
+    const Bundle_file bundle{bundle_};
+    std::vector<const Bundle_file::Reference*> references;
+    if (args_.empty()) {
+      for (const auto& reference : bundle.references())
+        references.push_back(&reference);
+    } else {
+      for (const auto& arg : args_) {
+        const auto& all = bundle.references();
+        const auto i = std::find_if(cbegin(all), cend(all), [&arg](const auto& reference)
+        {
+          return reference.name == arg;
+        });
+        if (i == cend(all))
+          throw std::runtime_error{"no reference \"" + arg + "\" in the bundle \"" +
+            bundle_.string() + "\""};
+        references.push_back(&*i);
+      }
+    }
+
+    Parameters parameters{{}, parameters_};
+    std::vector<std::vector<Sql_batch>> batches;
+    batches.reserve(references.size());
+    for (const auto* const reference : references) {
+      auto& reference_batches = batches.emplace_back();
+      reference_batches.reserve(reference->files.size());
+      for (const auto& file : reference->files) {
+        reference_batches.emplace_back(file.path, file.content, file.hash);
+        parameters.assign(file.path, file.parameters);
+      }
+    }
+
+    auto* const cn = conn();
+    Tx_guard t{cn};
+    const Canceller::Registration cr{canceller, cn, [this]{ return make_connection(); }};
+    for (std::size_t k = 0; k < references.size(); ++k) {
+      const auto count = execute(cn, batches[k], options_, nullptr, nullptr, nullptr, nullptr,
+        &parameters, nullptr, nullptr, &canceller);
+      print(std::cout, "The reference \"" + references[k]->name + "\". Executed queries count = " +
+        std::to_string(count) + ".\n");
+    }
+    t.commit();
+  }
+
+  /**
+   * @returns The commands to execute on the targets listed in the file at
+   * `path`, one per line, as the whitespace-separated connection options
+   * (like `host=shard1 database=app`) which override the options of `params`.
+   */
+  static std::vector<std::unique_ptr<Exec>> make_targets(const app::Program_parameters& params,
+    const filesystem::path& path)
+  {
+    static const std::unordered_set<std::string> connection_options{"host", "address",
+      "port", "database", "username", "password", "client_encoding", "connect_timeout"};
+    std::ifstream stream{path};
+    if (!stream)
+      throw std::runtime_error{"cannot open file \"" + path.string() + "\""};
+
+    std::vector<std::unique_ptr<Exec>> result;
+    std::string line;
+    for (std::size_t lnum = 1; std::getline(stream, line); ++lnum) {
+      std::istringstream tokens{line};
+      std::string token;
+      if (!(tokens >> token) || token.front() == '#')
+        continue;
+
+      auto options = params.options();
+      options.erase("targets");
+      options.erase("two_phase");
+      options.erase("server");
+      do {
+        const auto eq = token.find('=');
+        if (eq == std::string::npos || !connection_options.count(token.substr(0, eq)))
+          throw std::runtime_error{path.string() + ":" + std::to_string(lnum) +
+            ": invalid connection option \"" + token + "\""};
+        options[token.substr(0, eq)] = token.substr(eq + 1);
+      } while (tokens >> token);
+      result.push_back(std::make_unique<Exec>(app::Program_parameters{params.executable_path(),
+        "exec", std::move(options), params.arguments()}));
+    }
+    if (result.empty())
+      throw std::runtime_error{"no targets specified in \"" + path.string() + "\""};
+    return result;
+  }
+
+  /// @brief The state of the project shared by the modes of the execution.
+  struct Context final {
+    explicit Context(const Exec& exec)
+      : root{Util::root_path()}
+      , parameters{root, exec.parameters_}
+      , timeouts{root, exec.options_.timeouts}
+      , tree{root, exec.options_.tree_index ?
+          std::make_optional(root / root_marker / "tree_index") : std::nullopt}
+    {
+      if (exec.options_.learned_order)
+        order.emplace(root / root_marker / "exec_order");
+    }
+
+    const filesystem::path root;
+    std::optional<Execution_order> order;
+    Parameters parameters;
+    Timeouts timeouts;
+    Project_tree tree;
+  };
+
+  /**
+   * @brief Runs the command on each of the targets concurrently, and commits
+   * the transactions only if the execution succeeded on all of the targets.
+   */
+  void run_targets(Profile* const profile, Diagnostics* const diagnostics,
+    const Canceller& canceller)
+  {
+    using Clock = Profile::Clock;
+    Context context{*this};
+
+    // The project is resolved and parsed once for all the targets.
+    auto start = Clock::now();
+    std::vector<filesystem::path> references;
+    references.reserve(args_.size());
+    for (const auto& arg : args_)
+      references.push_back(context.root / arg);
+    const auto paths = context.tree.sql_paths(references);
+    context.tree.save_index();
+    if (profile)
+      profile->phase("resolution", start);
+    start = Clock::now();
+    std::vector<std::vector<Sql_batch>> batches;
+    for (const auto& arg_paths : paths)
+      batches.push_back(cache_ ? cache_->batches(arg_paths) : Sql_batch::make_many(arg_paths));
+    if (profile)
+      profile->phase("loading", start);
+
+    const auto target_name = [this](const std::size_t t)
+    {
+      const auto& target = *targets_[t];
+      return target.database() + "@" + target.host_address() + ":" + target.host_port();
+    };
+    const auto transaction_id = [prefix = transaction_id_prefix(context.root)](const std::size_t t)
+    {
+      return quoted_transaction_id(prefix, t);
+    };
+
+    std::vector<std::exception_ptr> errors(targets_.size());
+    std::vector<char> is_prepared(targets_.size());
+    std::vector<std::vector<Execution_order::Key>> executed_keys(targets_.size());
+    const auto execute_target = [&](const std::size_t t)
+    {
+      struct Current_target final {
+        explicit Current_target(std::string name) { current_target_ = std::move(name); }
+        ~Current_target() { current_target_.clear(); }
+      } const current_target{target_name(t)};
+      try {
+        const auto start = Clock::now();
+        auto* const conn = targets_[t]->conn();
+        Tx_guard::begin(conn);
+        const Canceller::Registration cr{canceller, conn,
+          [this, t]{ return targets_[t]->make_connection(); }};
+        std::size_t count{};
+        for (std::size_t k = 0; k < batches.size(); ++k) {
+          std::vector<Execution_order::Key> keys;
+          count += execute(conn, batches[k], options_,
+            context.order ? &*context.order : nullptr, context.order ? &keys : nullptr, nullptr,
+            profile, &context.parameters, diagnostics, &context.timeouts, &canceller);
+          executed_keys[t].insert(cend(executed_keys[t]), std::make_move_iterator(begin(keys)),
+            std::make_move_iterator(end(keys)));
+        }
+        if (options_.two_phase) {
+          conn->perform("prepare transaction " + transaction_id(t));
+          is_prepared[t] = true;
+        }
+        if (profile)
+          profile->phase("execution " + target_name(t), start);
+        print(std::cout, "The target \"" + target_name(t) + "\". Executed queries count = " +
+          std::to_string(count) + ".\n");
+      } catch (...) {
+        errors[t] = std::current_exception();
+      }
+    };
+
+    std::vector<std::thread> threads;
+    threads.reserve(targets_.size() - 1);
+    for (std::size_t t = 1; t < targets_.size(); ++t)
+      threads.emplace_back(execute_target, t);
+    execute_target(0);
+    for (auto& thread : threads)
+      thread.join();
+
+    // Either all the transactions are committed, or all of them are rolled back.
+    const bool is_failed = std::any_of(cbegin(errors), cend(errors),
+      [](const auto& e) { return static_cast<bool>(e); });
+    bool is_ok = !is_failed;
+    const auto unresolved = [&](const std::size_t t)
+    {
+      return is_prepared[t] ? std::string{" (the prepared transaction "} + transaction_id(t) +
+        " must be " + (is_failed ? "rolled back" : "committed") + " on it manually)" : std::string{};
+    };
+    start = Clock::now();
+    for (std::size_t t = 0; t < targets_.size(); ++t) {
+      try {
+        if (errors[t])
+          std::rethrow_exception(errors[t]);
+        auto* const conn = targets_[t]->conn();
+        if (is_prepared[t])
+          conn->perform((is_failed ? "rollback prepared " : "commit prepared ") + transaction_id(t));
+        else if (is_failed)
+          Tx_guard::rollback(conn);
+        else
+          Tx_guard::commit(conn);
+      } catch (const Handled_exception&) {
+        print(std::cerr, "The target \"" + target_name(t) + "\" failed.\n");
+        is_ok = false;
+      } catch (const pgfe::Server_exception& e) {
+        print(std::cerr, "The target \"" + target_name(t) + "\" failed: " + e.error()->brief() +
+          unresolved(t) + "\n");
+        is_ok = false;
+      } catch (const std::exception& e) {
+        print(std::cerr, "The target \"" + target_name(t) + "\" failed: " + e.what() + unresolved(t) + "\n");
+        is_ok = false;
+      }
+    }
+    if (profile)
+      profile->phase(is_failed ? "rollback" : "commit", start);
+    if (!is_ok)
+      throw Handled_exception{};
+
+    if (context.order) {
+      context.order->update(executed_keys.front());
+      context.order->save();
+    }
+  }
+
+  /**
+   * @brief Runs the command and records the profile and the diagnostics (if
+   * `profile` and `diagnostics` are not `nullptr`).
+   */
+  void run(Profile* const profile, Diagnostics* const diagnostics, const Canceller& canceller)
+  {
+    if (!targets_.empty())
+      return run_targets(profile, diagnostics, canceller);
+    else if (options_.queue_depth)
+      return run_queued(profile, diagnostics, canceller);
+
+    using Clock = Profile::Clock;
+    Context context{*this};
+
+    /*
+     * The SQL files are loaded and parsed in background (in order of the
+     * arguments) while connecting to the server and executing the batches
+     * of the preceding arguments.
+     */
+    auto start = Clock::now();
+    auto paths = [&]
+    {
+      std::vector<filesystem::path> references;
+      references.reserve(args_.size());
+      for (const auto& arg : args_)
+        references.push_back(context.root / arg);
+      return context.tree.sql_paths(references);
+    }();
+    context.tree.save_index();
+
+    /*
+     * The large files are not loaded, but executed in streaming mode after
+     * the rest of the files of the same argument.
+     */
+    std::vector<std::vector<filesystem::path>> streamed_paths(paths.size());
+    if (options_.stream_threshold) {
+      for (std::size_t k = 0; k < paths.size(); ++k) {
+        const auto b = begin(paths[k]), e = end(paths[k]);
+        const auto p = std::stable_partition(b, e, [this](const filesystem::path& path)
+        {
+          return filesystem::file_size(path) < options_.stream_threshold;
+        });
+        streamed_paths[k].assign(std::make_move_iterator(p), std::make_move_iterator(e));
+        paths[k].erase(p, e);
+      }
+    }
+    if (profile)
+      profile->phase("resolution", start);
+    std::vector<std::promise<std::vector<Sql_batch>>> promises(args_.size());
+    std::vector<std::future<std::vector<Sql_batch>>> batches;
+    batches.reserve(promises.size());
+    for (auto& promise : promises)
+      batches.push_back(promise.get_future());
+    const auto loader = std::async(std::launch::async, [this, &paths, &promises, profile]
+    {
+      for (std::size_t k = 0; k < promises.size(); ++k) {
+        try {
+          const auto start = Clock::now();
+          promises[k].set_value(cache_ ? cache_->batches(paths[k]) : Sql_batch::make_many(paths[k]));
+          if (profile)
+            profile->phase("loading " + args_[k], start);
+        } catch (...) {
+          promises[k].set_exception(std::current_exception());
+        }
+      }
+    });
+
+    start = Clock::now();
+    auto* const cn = conn();
+    Tx_guard t{cn};
+    const Canceller::Registration cr{canceller, cn, [this]{ return make_connection(); }};
+    if (profile)
+      profile->phase("connection", start);
+
+    std::optional<Ledger> ledger;
+    std::vector<std::vector<Sql_batch>> outdated_batches;
+    if (options_.incremental) {
+      start = Clock::now();
+      const auto identity = Ledger::identity(cn);
+      ledger.emplace(cn,
+        context.root / root_marker / ("ledger_" + Util::hex(Util::hash(identity))));
+      for (auto& b : batches)
+        outdated_batches.push_back(b.get());
+      outdated_batches = outdated(std::move(outdated_batches), *ledger, context.parameters,
+        context.root);
+      if (profile)
+        profile->phase("ledger", start);
+    }
+
+    std::mutex mutex;
+    std::vector<Execution_order::Key> executed_keys;
+    const auto execute_arg = [&](pgfe::Connection* const conn, const std::size_t k)
+    {
+      const auto arg_batches = ledger ? std::move(outdated_batches[k]) : batches[k].get();
+      const auto start = Clock::now();
+      std::vector<Execution_order::Key> keys;
+      auto count = execute(conn, arg_batches, options_,
+        context.order ? &*context.order : nullptr, context.order ? &keys : nullptr, nullptr,
+        profile, &context.parameters, diagnostics, &context.timeouts, &canceller);
+      if (profile)
+        profile->phase("execution " + args_[k], start);
+
+      std::vector<std::pair<std::string, std::uint64_t>> streamed; // paths and hashes
+      for (const auto& path : streamed_paths[k]) {
+        auto project_path = Util::project_path(path, context.root);
+        auto hash = ledger ? Util::file_hash(path) : 0;
+        if (const auto companion = ledger ? Sql_batch::companion_path(path) : std::nullopt)
+          hash = Util::file_hash(*companion, hash);
+        if (ledger) {
+          const std::lock_guard lg{mutex};
+          if (ledger->is_deployed(project_path, hash))
+            continue;
+        }
+        const auto start = Clock::now();
+        count += execute_stream(conn, path, profile, diagnostics, &canceller);
+        if (profile)
+          profile->phase("streaming " + project_path, start);
+        streamed.emplace_back(std::move(project_path), hash);
+      }
+
+      const std::lock_guard lg{mutex};
+      executed_keys.insert(cend(executed_keys), std::make_move_iterator(begin(keys)),
+        std::make_move_iterator(end(keys)));
+      print(std::cout, "The reference \"" + args_[k] + "\". Executed queries count = " +
+        std::to_string(count) + ".\n");
+      if (ledger) {
+        for (const auto& b : arg_batches) {
+          if (const auto& path = b.path())
+            ledger->record(Util::project_path(*path, context.root),
+              deployed_hash(b, context.parameters));
+        }
+        for (auto& [path, hash] : streamed)
+          ledger->record(std::move(path), hash);
+      }
+    };
+
+    std::vector<std::unique_ptr<pgfe::Connection>> conns;
+    if (options_.jobs > 1) {
+      /*
+       * The task 0 consists of the non-concurrent references which are
+       * executed in order on the main connection. Each concurrent reference
+       * is a separate task which is executed on any of the connections. (The
+       * task 0 is executed by the worker 0 while the other workers execute the
+       * concurrent tasks, so the concurrent references must be independent.)
+       */
+      std::vector<std::vector<std::size_t>> tasks(1);
+      for (std::size_t k = 0; k < args_.size(); ++k) {
+        if (context.tree.is_concurrent(context.root / args_[k]))
+          tasks.push_back({k});
+        else
+          tasks[0].push_back(k);
+      }
+
+      const auto worker_count = std::min(options_.jobs, tasks.size());
+      conns.resize(worker_count);
+      std::vector<std::optional<Canceller::Registration>> registrations(worker_count);
+      std::vector<std::exception_ptr> errors(worker_count);
+      std::atomic<std::size_t> next_task{1};
+      std::atomic<bool> is_failed{};
+      const auto work = [&](const std::size_t w)
+      {
+        try {
+          if (!w) {
+            for (const auto k : tasks[0])
+              execute_arg(cn, k);
+          }
+          for (auto task = next_task++; task < tasks.size() && !is_failed; task = next_task++) {
+            auto* conn = w ? conns[w].get() : cn;
+            if (!conn) {
+              conns[w] = make_connection();
+              conn = conns[w].get();
+              Tx_guard::begin(conn);
+              registrations[w].emplace(canceller, conn, [this]{ return make_connection(); });
+            }
+            for (const auto k : tasks[task])
+              execute_arg(conn, k);
+          }
+        } catch (...) {
+          errors[w] = std::current_exception();
+          is_failed = true;
+        }
+      };
+
+      std::vector<std::thread> threads;
+      threads.reserve(worker_count - 1);
+      for (std::size_t w = 1; w < worker_count; ++w)
+        threads.emplace_back(work, w);
+      work(0);
+      for (auto& thread : threads)
+        thread.join();
+      for (const auto& error : errors) {
+        if (error)
+          std::rethrow_exception(error);
+      }
+    } else {
+      for (std::size_t k = 0; k < args_.size(); ++k)
+        execute_arg(cn, k);
+    }
+
+    start = Clock::now();
+    if (ledger)
+      ledger->flush(cn);
+    if (options_.two_phase)
+      commit_jobs(conns, t, context.root);
+    else {
+      for (const auto& c : conns) {
+        if (c)
+          Tx_guard::commit(c.get());
+      }
+      t.commit();
+    }
+    if (profile)
+      profile->phase("commit", start);
+
+    if (context.order) {
+      context.order->update(executed_keys);
+      context.order->save();
+    }
+    if (ledger)
+      ledger->save();
+  }
+
+  /**
+   * @returns The prefix of the identifiers of the prepared transactions of the
+   * execution in the project at `root`, which is unique for the project and
+   * the moment of the call.
+   */
+  static std::string transaction_id_prefix(const filesystem::path& root)
+  {
+    return "pgspa_" + Util::hex(Util::hash(root.string() +
+      std::to_string(std::chrono::system_clock::now().time_since_epoch().count())));
+  }
+
+  /**
+   * @returns The quoted identifier of the `n`-th prepared transaction with
+   * the `prefix`.
+   *
+   * @remarks The identifier consists only of letters, digits and underscores,
+   * so it's quoted without the connection (which may be lost by the moment
+   * the identifier is reported).
+   */
+  static std::string quoted_transaction_id(const std::string& prefix, const std::size_t n)
+  {
+    return "'" + prefix + "_" + std::to_string(n) + "'";
+  }
+
+  /**
+   * @brief Commits the transactions of the jobs (i.e. of the `conns` and of
+   * the main one guarded by `t`) by using the two-phase commit: either all
+   * of them are committed, or all of them are rolled back.
+   *
+   * @remarks If `COMMIT PREPARED` of some transaction fails after the others
+   * are committed, its identifier is reported to resolve it manually.
+   */
+  static void commit_jobs(const std::vector<std::unique_ptr<pgfe::Connection>>& conns,
+    Tx_guard& t, const filesystem::path& root)
+  {
+    const auto transaction_id = [prefix = transaction_id_prefix(root)](const std::size_t w)
+    {
+      return quoted_transaction_id(prefix, w);
+    };
+
+    std::vector<std::size_t> prepared;
+    try {
+      for (std::size_t w = 0; w < conns.size(); ++w) {
+        if (conns[w]) {
+          conns[w]->perform("prepare transaction " + transaction_id(w));
+          prepared.push_back(w);
+        }
+      }
+      t.commit();
+    } catch (...) {
+      for (const auto w : prepared) {
+        try {
+          conns[w]->perform("rollback prepared " + transaction_id(w));
+        } catch (const std::exception& e) {
+          print(std::cerr, "Cannot roll back the prepared transaction " + transaction_id(w) +
+            " of the job " + std::to_string(w) + ": " + e.what() + "\n");
+        }
+      }
+      throw;
+    }
+
+    bool is_ok{true};
+    for (const auto w : prepared) {
+      try {
+        conns[w]->perform("commit prepared " + transaction_id(w));
+      } catch (const std::exception& e) {
+        print(std::cerr, "Cannot commit the prepared transaction " + transaction_id(w) +
+          " of the job " + std::to_string(w) + " (it must be committed manually): " + e.what() + "\n");
+        is_ok = false;
+      }
+    }
+    if (!is_ok)
+      throw Handled_exception{};
+  }
+
+  /**
+   * @brief Runs the command by using the pipeline of two stages: the
+   * producer resolves the references, loads and parses the SQL files and
+   * passes the batches through the queue of `Options::queue_depth` batches to
+   * the executor. Thus, the execution starts as soon as the first SQL files
+   * are parsed, and the number of the batches in memory is limited by the
+   * depth of the queue (and by the number of the batches of the queries
+   * waiting to be retried).
+   */
+  void run_queued(Profile* const profile, Diagnostics* const diagnostics,
+    const Canceller& canceller)
+  {
+    using Clock = Profile::Clock;
+    Context context{*this};
+
+    /*
+     * The SQL files are parsed by groups of the size of the queue (in
+     * parallel). The end of the batches of each reference is denoted by
+     * `std::nullopt`. The queue is closed by the producer on error (which is
+     * rethrown by the `producer.get()`), or by the executor to stop the
+     * producer.
+     */
+    Bounded_queue<std::optional<Sql_batch>> queue{options_.queue_depth};
+    auto producer = std::async(std::launch::async, [this, &context, &queue, profile]
+    {
+      try {
+        std::unordered_set<std::string> seen; // each SQL file is executed only once
+        for (const auto& arg : args_) {
+          const auto start = Clock::now();
+          std::vector<filesystem::path> paths;
+          for (const auto& path : context.tree.sql_paths(context.root / arg)) {
+            if (seen.insert(path.string()).second)
+              paths.push_back(path);
+          }
+          for (std::size_t p = 0; p < paths.size(); p += options_.queue_depth) {
+            const std::vector<filesystem::path> group(cbegin(paths) + p,
+              cbegin(paths) + std::min(p + options_.queue_depth, paths.size()));
+            for (auto& batch : cache_ ? cache_->batches(group) : Sql_batch::make_many(group)) {
+              if (!queue.push(std::move(batch)))
+                return;
+            }
+          }
+          if (!queue.push(std::nullopt))
+            return;
+          if (profile)
+            profile->phase("loading " + arg, start);
+        }
+        context.tree.save_index();
+      } catch (...) {
+        queue.close();
+        throw;
+      }
+    });
+
+    std::vector<Execution_order::Key> executed_keys;
+    try {
+      auto start = Clock::now();
+      auto* const cn = conn();
+      Tx_guard t{cn};
+      const Canceller::Registration cr{canceller, cn, [this]{ return make_connection(); }};
+      if (profile)
+        profile->phase("connection", start);
+
+      for (const auto& arg : args_) {
+        // The portion consists of at least one batch and of the rest of the queued ones.
+        bool is_end{};
+        const auto next_batches = [&queue, &producer, &is_end]
+        {
+          std::vector<Sql_batch> result;
+          while (!is_end) {
+            auto batch = result.empty() ? queue.pop() : queue.try_pop();
+            if (!batch) {
+              if (!result.empty())
+                break;
+              producer.get(); // rethrows the error of the producer
+              throw std::logic_error{"the queue of the batches is closed unexpectedly"};
+            } else if (!*batch)
+              is_end = true;
+            else
+              result.push_back(std::move(**batch));
+          }
+          return result;
+        };
+
+        start = Clock::now();
+        std::vector<Execution_order::Key> keys;
+        const auto count = execute(cn, next_batches, options_,
+          context.order ? &*context.order : nullptr, context.order ? &keys : nullptr, nullptr,
+          profile, &context.parameters, diagnostics, &context.timeouts, &canceller);
+        if (profile)
+          profile->phase("execution " + arg, start);
+
+        executed_keys.insert(cend(executed_keys), std::make_move_iterator(begin(keys)),
+          std::make_move_iterator(end(keys)));
+        print(std::cout, "The reference \"" + arg + "\". Executed queries count = " +
+          std::to_string(count) + ".\n");
+      }
+      producer.get();
+
+      start = Clock::now();
+      t.commit();
+      if (profile)
+        profile->phase("commit", start);
+    } catch (...) {
+      queue.close();
+      throw;
+    }
+
+    if (context.order) {
+      context.order->update(executed_keys);
+      context.order->save();
+    }
+  }
+
+  /**
+   * @returns The batches of the files changed since the last deploy according
+   * to the `ledger` and the batches (transitively) dependent on them, in the
+   * same order as in `batches`.
+   *
+   * @remarks The dependencies between the batches are determined by using
+   * the static analysis of the queries.
+   */
+  static std::vector<std::vector<Sql_batch>> outdated(std::vector<std::vector<Sql_batch>>&& batches,
+    const Ledger& ledger, Parameters& parameters, const filesystem::path& root)
+  {
+    std::vector<std::pair<std::size_t, std::size_t>> indexes; // of `batches`
+    std::vector<Sql_analyzer::Objects> objects; // aligned with `indexes`
+    for (std::size_t k = 0; k < batches.size(); ++k) {
+      for (std::size_t i = 0; i < batches[k].size(); ++i) {
+        Sql_analyzer::Objects o;
+        const auto* const vec = batches[k][i].sql_vector();
+        for (std::size_t j = 0; j < vec->sql_string_count(); ++j) {
+          if (const auto* const sql_string = vec->sql_string(j); !sql_string->is_query_empty()) {
+            auto so = Sql_analyzer::analyze(sql_string->to_query_string());
+            o.created.insert(cend(o.created), std::make_move_iterator(begin(so.created)),
+              std::make_move_iterator(end(so.created)));
+            o.referenced.insert(cend(o.referenced), std::make_move_iterator(begin(so.referenced)),
+              std::make_move_iterator(end(so.referenced)));
+          }
+        }
+        indexes.emplace_back(k, i);
+        objects.push_back(std::move(o));
+      }
+    }
+
+    std::unordered_map<std::string, std::vector<std::size_t>> referencing;
+    for (std::size_t b = 0; b < objects.size(); ++b) {
+      for (const auto& reference : objects[b].referenced)
+        referencing[reference.name].push_back(b);
+    }
+
+    std::vector<bool> is_outdated(objects.size());
+    std::deque<std::size_t> queue;
+    for (std::size_t b = 0; b < objects.size(); ++b) {
+      const auto& batch = batches[indexes[b].first][indexes[b].second];
+      const auto& path = batch.path();
+      if (!path || !ledger.is_deployed(Util::project_path(*path, root), deployed_hash(batch, parameters))) {
+        is_outdated[b] = true;
+        queue.push_back(b);
+      }
+    }
+    while (!queue.empty()) {
+      const auto b = queue.front();
+      queue.pop_front();
+      for (const auto& name : objects[b].created) {
+        if (const auto r = referencing.find(name); r != cend(referencing)) {
+          for (const auto d : r->second) {
+            if (!is_outdated[d]) {
+              is_outdated[d] = true;
+              queue.push_back(d);
+            }
+          }
+        }
+      }
+    }
+
+    std::vector<std::vector<Sql_batch>> result(batches.size());
+    for (std::size_t b = 0; b < objects.size(); ++b) {
+      if (is_outdated[b]) {
+        const auto [k, i] = indexes[b];
+        result[k].push_back(std::move(batches[k][i]));
+      }
+    }
+    return result;
+  }
+
+  /**
+   * @returns The hash of the file of `batch` to record in the ledger: the hash
+   * of its content folded with the values of the named parameters of its
+   * queries, so the file is considered changed when these values are changed.
+   */
+  static std::uint64_t deployed_hash(const Sql_batch& batch, Parameters& parameters)
+  {
+    ASSERT(batch.path());
+    std::set<std::string> names;
+    const auto* const vec = batch.sql_vector();
+    for (std::size_t j = 0; j < vec->sql_string_count(); ++j) {
+      const auto* const sql_string = vec->sql_string(j);
+      for (std::size_t p = 0; p < sql_string->parameter_count(); ++p) {
+        if (auto name = sql_string->parameter_name(p); !name.empty())
+          names.insert(std::move(name));
+      }
+      with_quoted_parameters(sql_string->to_query_string(), [&names](const std::string& name, bool)
+      {
+        names.insert(name);
+        return std::string{};
+      });
+    }
+
+    auto result = batch.hash();
+    const auto& values = parameters.values(*batch.path());
+    for (const auto& name : names) {
+      result = Util::hash(name, result);
+      if (const auto v = values.find(name); v != cend(values) && v->second)
+        result = Util::hash("=" + *v->second, result);
+      else
+        result = Util::hash(std::string_view{"", 1}, result); // NULL or no value
+    }
+    return result;
+  }
+
+  /**
+   * @brief Prints the Emacs-friendly information about an error to the standard
+   * error, and records it to the `diagnostics` (if it's not `nullptr`).
+   */
+  template<typename E>
+  static void report_file_error(const filesystem::path& path, const std::size_t lnum,
+    const std::size_t cnum, const E* const err, Diagnostics* const diagnostics)
+  {
+    if (diagnostics)
+      diagnostics->add(path, lnum, cnum, err, current_target_);
+
+    /*
+     * Use GNU style for reporting error messages:
+     * foo.sql:3:1:Error: End of file during parsing
+     * (See etc/compilation.txt of Emacs installation.)
+     */
+    std::ostringstream message;
+    message << absolute(path).string() << ":"
+            << lnum << ":" << cnum << ":Error: " << err->brief();
+    if (const auto& d = err->detail())
+      message << "\n Detail: " << *d;
+    if (const auto& h = err->hint())
+      message << "\n Hint: " << *h;
+    if (const auto& c = err->context())
+      message << "\n Context: " << *c;
+    message << "\n";
+    print_error(message.str());
+  }
+
+  /**
+   * @brief Prints the error `message` to the standard error, prefixed with
+   * the name of the target of the current thread (if any).
+   */
+  static void print_error(const std::string& message)
+  {
+    print(std::cerr, current_target_.empty() ? message : current_target_ + ": " + message);
+  }
+
+  /// @returns `true` if the error `e` means that the object to create is already exists.
+  static bool is_ignorable(const pgfe::Server_exception& e)
+  {
+    return e.code() == pgfe::Server_errc::c42_duplicate_table ||
+      e.code() == pgfe::Server_errc::c42_duplicate_function ||
+      e.code() == pgfe::Server_errc::c42_duplicate_object ||
+      e.code() == pgfe::Server_errc::c42_duplicate_schema;
+  }
+
+  /// @returns `true` if the error `e` means that the lock could not be acquired in time.
+  static bool is_lock_not_available(const pgfe::Server_exception& e)
+  {
+    return e.code() == pgfe::Server_errc::c55_lock_not_available;
+  }
+
+  /// @returns `true` if the error `e` may gone after the execution of the other queries.
+  static bool is_non_fatal(const pgfe::Server_exception& e)
+  {
+    return e.code() == pgfe::Server_errc::c42_undefined_table ||
+      e.code() == pgfe::Server_errc::c42_undefined_function ||
+      e.code() == pgfe::Server_errc::c42_undefined_object ||
+      e.code() == pgfe::Server_errc::c3f_invalid_schema_name ||
+      e.code() == pgfe::Server_errc::c2b_dependent_objects_still_exist;
+  }
+
+  /**
+   * @returns `false`, since the COPY queries create nothing.
+   *
+   * @remarks The overloads for `Copy_error` classify the errors by the same
+   * SQLSTATE codes as the overloads for `pgfe::Server_exception`.
+   */
+  static bool is_ignorable(const Copy_error&)
+  {
+    return false;
+  }
+
+  /// @overload
+  static bool is_lock_not_available(const Copy_error& e)
+  {
+    return e.sqlstate() == "55P03";
+  }
+
+  /// @overload
+  static bool is_non_fatal(const Copy_error& e)
+  {
+    static const std::array<std::string_view, 5> codes{"42P01", "42883", "42704", "3F000", "2BP01"};
+    return std::find(cbegin(codes), cend(codes), e.sqlstate()) != cend(codes);
   }
 
-  const std::optional<std::string>& password() const
+  /// @returns `true` if the `query` is a utility statement (i.e. cannot be prepared).
+  static bool is_utility(const std::string_view query)
   {
-    ASSERT_ALWAYS(delegate() || data_);
-    if (auto* const d = delegate())
-      return d->password();
-    else
-      return data_->password_;
+    using Kind = Sql_lexer::Lexeme::Kind;
+    Sql_lexer lexer{query};
+    auto lexeme = lexer.next();
+    while (lexeme && (lexeme->kind == Kind::space || lexeme->kind == Kind::comment))
+      lexeme = lexer.next();
+    std::string word;
+    if (lexeme && lexeme->kind == Kind::word) {
+      for (const char c : lexeme->text)
+        word.push_back(static_cast<char>(std::tolower(static_cast<unsigned char>(c))));
+    }
+    static const std::unordered_set<std::string> preparable{"select", "insert", "update",
+      "delete", "with", "values", "table"};
+    return !preparable.count(word);
   }
 
-  std::chrono::seconds connect_timeout() const
+  /**
+   * @brief Substitutes the references to the named parameters quoted like in
+   * `psql`, i.e. `:'name'` and `:"name"`, of the `query` by the result of
+   * `value(name, is_identifier)`.
+   *
+   * @returns The substituted query, or `std::nullopt` if there are no such
+   * references in the `query` (outside of the literals and the comments).
+   */
+  template<typename F>
+  static std::optional<std::string> with_quoted_parameters(const std::string_view query, F&& value)
   {
-    ASSERT_ALWAYS(delegate() || data_);
-    if (auto* const d = delegate())
-      return d->connect_timeout();
-    else
-      return data_->connect_timeout_;
+    std::optional<std::string> result;
+    std::size_t copied{}; // the size of the part of `query` copied to `result`
+    Sql_lexer lexer{query};
+    while (const auto lexeme = lexer.next()) {
+      if (lexeme->kind != Sql_lexer::Lexeme::Kind::variable)
+        continue;
+
+      if (!result)
+        result.emplace();
+      const auto offset = static_cast<std::size_t>(lexeme->text.data() - query.data());
+      result->append(query.substr(copied, offset - copied))
+        .append(value(std::string{lexeme->variable_name()}, lexeme->text[1] == '"'));
+      copied = offset + lexeme->text.size();
+    }
+    if (result)
+      result->append(query.substr(copied));
+    return result;
   }
 
-  /// @returns The opened connection to the PostgreSQL server.
-  pgfe::Connection* conn()
+  /// @brief Writes `text` to `stream` atomically with respect to the concurrent jobs.
+  static void print(std::ostream& stream, const std::string& text)
   {
-    ASSERT_ALWAYS(delegate() || data_);
-    namespace pgfe = dmitigr::pgfe;
-    if (auto* const d = delegate()) {
-      return d->conn();
-    } else {
-      auto& conn = data_->conn_;
+    static std::mutex mutex;
+    const std::lock_guard lg{mutex};
+    stream << text;
+  }
+};
 
-      if (!conn) {
-        conn = pgfe::Connection_options::make(pgfe::Communication_mode::net)->
-          set_net_address(host_address())->
-          set_net_hostname(host_name())->
-          set_port(std::stoi(host_port()))->
-          set_database(database())->
-          set_username(username())->
-          set_password(password())->
-          make_connection();
-      }
+// =============================================================================
 
-      if (!conn->is_connected()) {
-        conn->connect(data_->connect_timeout_);
-        if (!data_->client_encoding_.empty())
-          conn->perform("set client_encoding to " +
-            conn->to_quoted_identifier(data_->client_encoding_));
-      }
+#ifdef __linux__
+/**
+ * @brief A watcher of the changes of the project tree (by using inotify).
+ *
+ * The hidden files and directories (including the directory `.pgspa`) are not
+ * watched, except the per-directory configuration files.
+ */
+class Tree_watcher final {
+public:
+  /// @brief The changes of the project tree.
+  struct Changes final {
+    /// The SQL files which are changed, created or removed.
+    std::set<filesystem::path> sql_paths;
 
-      return conn.get();
-    }
+    /// The directories whose per-directory configuration files are changed.
+    std::set<filesystem::path> config_directories;
+
+    /// `true` if the directories, the shortcuts or the configuration are changed.
+    bool is_structural{};
+
+    /// `true` if some events are lost (so any file could be changed).
+    bool is_overflowed{};
+  };
+
+  Tree_watcher(const Tree_watcher&) = delete;
+  Tree_watcher& operator=(const Tree_watcher&) = delete;
+  Tree_watcher(Tree_watcher&&) = delete;
+  Tree_watcher& operator=(Tree_watcher&&) = delete;
+
+  ~Tree_watcher()
+  {
+    ::close(fd_);
   }
 
-  bool is_valid() const override
+  /// @brief The constructor.
+  explicit Tree_watcher(filesystem::path root)
+    : root_{std::move(root)}
+    , fd_{::inotify_init1(IN_CLOEXEC)}
   {
-    return (data_ && !delegate() && Command::is_valid()) ||
-      (!data_ && delegate() && delegate()->is_valid());
+    if (fd_ < 0)
+      throw std::system_error{errno, std::system_category(), "cannot initialize inotify"};
+    add(root_);
+  }
+
+  /**
+   * @brief Waits for the changes of the project tree.
+   *
+   * @returns The changes made until the tree is quiet for the `quiet_period`
+   * (so the series of the changes made by a single save are merged).
+   */
+  Changes wait(const std::chrono::milliseconds quiet_period)
+  {
+    Changes result;
+    int timeout{-1};
+    while (true) {
+      ::pollfd p{fd_, POLLIN, 0};
+      if (const int r = ::poll(&p, 1, timeout); r < 0) {
+        if (errno != EINTR)
+          throw std::system_error{errno, std::system_category(), "cannot poll inotify"};
+      } else if (r > 0) {
+        read(result);
+        timeout = static_cast<int>(quiet_period.count());
+      } else if (!result.sql_paths.empty() || result.is_structural || result.is_overflowed)
+        return result;
+      else
+        timeout = -1; // the changes are irrelevant
+    }
   }
 
 private:
-  struct Data final {
-    std::string name_;
+  filesystem::path root_;
+  int fd_{-1};
+  std::map<int, filesystem::path> directories_;
 
-    std::string address_;
-    std::optional<std::string> host_;
-    std::string port_;
-    std::string database_;
-    std::string username_;
-    std::optional<std::string> password_;
-    std::string client_encoding_;
+  /// @brief Starts watching the `directory` and its subdirectories.
+  void add(const filesystem::path& directory)
+  {
+    constexpr std::uint32_t mask = IN_CLOSE_WRITE | IN_CREATE | IN_DELETE |
+      IN_MOVED_FROM | IN_MOVED_TO | IN_ONLYDIR;
+    if (const int wd = ::inotify_add_watch(fd_, directory.c_str(), mask); wd >= 0)
+      directories_[wd] = directory;
+    else if (errno == ENOENT || errno == ENOTDIR)
+      return; // already removed
+    else
+      throw std::system_error{errno, std::system_category(),
+        "cannot watch directory \"" + directory.string() + "\""};
+
+    std::error_code ec;
+    for (const auto& e : filesystem::directory_iterator{directory, ec}) {
+      const auto name = e.path().filename().string();
+      if (!name.empty() && name.front() != '.' && e.is_directory(ec))
+        add(e.path());
+    }
+  }
 
-    std::chrono::seconds connect_timeout_;
+  /// @brief Reads the pending events and accumulates them to `changes`.
+  void read(Changes& changes)
+  {
+    alignas(::inotify_event) char buffer[64 * 1024];
+    const auto size = ::read(fd_, buffer, sizeof(buffer));
+    if (size < 0) {
+      if (errno == EINTR || errno == EAGAIN)
+        return;
+      throw std::system_error{errno, std::system_category(), "cannot read inotify events"};
+    }
 
-    std::unique_ptr<pgfe::Connection> conn_;
-  };
-  mutable std::optional<Data> data_{Data{}};
-  Online* delegate_{};
-};
+    for (std::size_t offset{}; offset < static_cast<std::size_t>(size);) {
+      const auto* const event = reinterpret_cast<const ::inotify_event*>(buffer + offset);
+      offset += sizeof(::inotify_event) + event->len;
+      if (event->mask & IN_Q_OVERFLOW) {
+        changes.is_overflowed = true;
+        continue;
+      } else if (event->mask & IN_IGNORED) {
+        directories_.erase(event->wd);
+        continue;
+      }
 
-// =============================================================================
+      const auto d = directories_.find(event->wd);
+      if (d == cend(directories_) || !event->len)
+        continue;
+      const std::string name{event->name};
+      auto path = d->second / name;
+      if (name == per_directory_config.string()) {
+        changes.is_structural = true;
+        changes.config_directories.insert(d->second.lexically_normal());
+      } else if (name.empty() || name.front() == '.')
+        continue; // cannot be a reference (e.g. temporary file of an editor)
+      else if (event->mask & IN_ISDIR) {
+        changes.is_structural = true;
+        if (event->mask & (IN_CREATE | IN_MOVED_TO))
+          add(path);
+      } else if (const auto extension = path.extension(); extension == ".sql") {
+        if (event->mask & (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO))
+          changes.is_structural = true;
+        changes.sql_paths.insert(std::move(path));
+      } else if (extension == ".csv" || extension == ".tsv") {
+        changes.sql_paths.insert(path.replace_extension(".sql")); // the data of COPY
+      } else if (extension.empty())
+        changes.is_structural = true; // a shortcut
+    }
+  }
+};
+#endif
 
 /**
- * @brief The `exec` command.
+ * @brief The `watch` command.
  *
- * The `exec` command executes the bunch of specified SQL queries.
+ * Executes the references, then waits for the changes of the project tree and
+ * re-executes the references affected by them by using the same connection.
+ * The SQL files are parsed once and re-parsed only when they are changed.
  */
-class Exec final : public Online {
+class Watch final : public Online {
 public:
-  Exec()
-    : Online{"exec"}
+  Watch()
+    : Online{"watch"}
   {}
 
-  explicit Exec(Online* const delegate)
-    : Online{delegate}
-  {
-    ASSERT_ALWAYS(is_valid());
-  }
-
-  explicit Exec(const app::Program_parameters& params)
+  explicit Watch(const app::Program_parameters& params)
     : Online{params}
     , args_{params.arguments()}
   {
-    Util::check_options(params, {"host", "address", "port", "database",
-      "username", "password", "client_encoding", "connect_timeout"});
+    // The options are grouped as in the help.
+    auto options = std::vector<std::string>{
+      "host", "address", "port", "username", "password", "database", "client_encoding", "connect_timeout",
+      "pipeline", "optimistic", "commit",
+      "learned_order", "analysis",
+      "params_file"};
+    for (const auto& o : params.options()) {
+      if (!o.first.compare(0, parameter_prefix.size(), parameter_prefix))
+        options.push_back(o.first);
+    }
+    Util::check_options(params, options);
+
+    options_.pipeline = Util::boolean_option(params, "pipeline").value_or(false);
+    options_.learned_order = Util::boolean_option(params, "learned_order").value_or(true);
+    options_.analysis = Util::boolean_option(params, "analysis").value_or(true);
+    options_.optimistic = Util::boolean_option(params, "optimistic").value_or(false);
+    is_commit_ = Util::boolean_option(params, "commit").value_or(true);
+    parameters_ = Parameters::overrides(params);
 
     if (args_.empty())
       throw std::runtime_error("no references specified");
@@ -731,186 +6751,488 @@ public:
 
   void run() override
   {
-    auto* const cn = conn();
-    Tx_guard t{cn};
-    for (const auto& arg : args_) {
-      const auto count = execute(cn, Util::sql_paths(Util::root_path() / arg));
-      std::cout << "The reference \"" << arg << "\". Executed queries count = " << count << ".\n";
+#ifdef __linux__
+    using Clock = std::chrono::steady_clock;
+    const auto root = Util::root_path();
+    Tree_watcher watcher{root}; // started before the execution to miss nothing
+    std::optional<Execution_order> order;
+    if (options_.learned_order)
+      order.emplace(root / root_marker / "exec_order");
+    std::optional<Parameters> parameters;
+    Tree_watcher::Changes changes;
+    changes.is_structural = true;
+    std::vector<std::size_t> retried; // the references not executed since the connection is lost
+    while (true) {
+      const auto start = Clock::now();
+      try {
+        if (changes.is_structural || changes.is_overflowed)
+          parameters.emplace(root, parameters_);
+        auto affected = update(root, changes);
+        affected.insert(cend(affected), cbegin(retried), cend(retried));
+        std::sort(begin(affected), end(affected));
+        affected.erase(std::unique(begin(affected), end(affected)), end(affected));
+        retried.clear();
+        if (!affected.empty()) {
+          try {
+            execute(affected, order ? &*order : nullptr, &*parameters);
+          } catch (...) {
+            if (conn_ && !conn_->is_connected())
+              retried = affected;
+            throw;
+          }
+          std::cout << "Done in " << std::chrono::duration_cast<std::chrono::milliseconds>(
+            Clock::now() - start).count() << " ms. Watching for changes...\n";
+        }
+      } catch (const Handled_exception&) {
+        std::cout << "Failed. Watching for changes...\n";
+      } catch (const pgfe::Server_exception& e) {
+        std::cerr << "pgspa: server error: " << e.error()->brief() << "\n";
+        std::cout << "Failed. Watching for changes...\n";
+      } catch (const std::exception& e) {
+        std::cerr << "pgspa: " << e.what() << "\n";
+        std::cout << "Failed. Watching for changes...\n";
+      }
+      std::cout.flush();
+
+      // The changes made while reconnecting are kept by the watcher.
+      if (!retried.empty()) {
+        std::cout << "The connection is lost. Reconnecting..." << std::endl;
+        while (true) {
+          try {
+            conn();
+            break;
+          } catch (const std::exception&) {
+            std::this_thread::sleep_for(std::chrono::seconds{1});
+          }
+        }
+        changes = {};
+        continue;
+      }
+      changes = watcher.wait(std::chrono::milliseconds{50});
     }
-    t.commit();
+#else
+    throw std::runtime_error{"the command \"watch\" is supported only on Linux"};
+#endif
   }
 
 private:
   std::vector<std::string> args_;
+  Exec::Options options_;
+  Parameters::Values parameters_;
+  bool is_commit_{true};
+  std::vector<std::vector<filesystem::path>> paths_; // normalized
+  std::vector<std::vector<Sql_batch>> batches_;
+  pgfe::Connection* conn_{}; // the last used
+
+#ifdef __linux__
+  /**
+   * @brief Updates the paths and the batches of the references according to
+   * the `changes`.
+   *
+   * @returns The indexes of the references which are affected by the changes.
+   */
+  std::vector<std::size_t> update(const filesystem::path& root, const Tree_watcher::Changes& changes)
+  {
+    auto paths = paths_;
+    if (changes.is_structural || changes.is_overflowed || paths.size() != args_.size()) {
+      Project_tree tree{root};
+      std::vector<filesystem::path> references;
+      references.reserve(args_.size());
+      for (const auto& arg : args_)
+        references.push_back(root / arg);
+      paths = tree.sql_paths(references);
+      for (auto& arg_paths : paths) {
+        for (auto& path : arg_paths)
+          path = path.lexically_normal();
+      }
+    }
 
-  /// @brief Executes the SQL commands of the specified files in a transaction.
-  static std::size_t execute(pgfe::Connection* const conn,
-    const std::vector<filesystem::path>& paths)
+    const auto is_changed = [&changes](const filesystem::path& path)
+    {
+      return changes.is_overflowed || changes.sql_paths.count(path);
+    };
+    // The configuration of the directory applies to its subdirectories as well.
+    const auto is_reconfigured = [&changes](const filesystem::path& path)
+    {
+      return std::any_of(cbegin(changes.config_directories), cend(changes.config_directories),
+        [&path](const filesystem::path& directory)
+        {
+          const auto relative = path.lexically_relative(directory);
+          return !relative.empty() && *relative.begin() != "..";
+        });
+    };
+
+    try {
+      // The batches of the unchanged files are reused.
+      std::map<filesystem::path, Sql_batch> cache;
+      for (std::size_t k = 0; k < paths_.size(); ++k) {
+        for (std::size_t i = 0; i < paths_[k].size(); ++i) {
+          if (!is_changed(paths_[k][i]))
+            cache.emplace(paths_[k][i], std::move(batches_[k][i]));
+        }
+      }
+
+      std::vector<std::size_t> result;
+      std::vector<std::vector<Sql_batch>> batches(paths.size());
+      for (std::size_t k = 0; k < paths.size(); ++k) {
+        std::vector<filesystem::path> parsed_paths;
+        for (const auto& path : paths[k]) {
+          if (!cache.count(path))
+            parsed_paths.push_back(path);
+        }
+        auto parsed = Sql_batch::make_many(parsed_paths);
+        auto p = begin(parsed);
+        batches[k].reserve(paths[k].size());
+        for (const auto& path : paths[k]) {
+          if (const auto c = cache.find(path); c != cend(cache))
+            batches[k].push_back(std::move(c->second));
+          else
+            batches[k].push_back(std::move(*p++));
+        }
+        if (!parsed.empty() || k >= paths_.size() || paths[k] != paths_[k] ||
+          std::any_of(cbegin(paths[k]), cend(paths[k]), is_reconfigured))
+          result.push_back(k);
+      }
+      paths_ = std::move(paths);
+      batches_ = std::move(batches);
+      return result;
+    } catch (...) {
+      paths_.clear(); // everything will be re-parsed on the next change
+      batches_.clear();
+      throw;
+    }
+  }
+
+  /// @brief Executes the references `ks` in a transaction.
+  void execute(const std::vector<std::size_t>& ks, Execution_order* const order,
+    Parameters* const parameters)
   {
-    return execute(conn, Sql_batch::make_many(paths));
+    auto* const cn = conn_ = conn(); // reconnects if the connection is lost
+    Tx_guard t{cn};
+    std::vector<Execution_order::Key> executed_keys;
+    for (const auto k : ks) {
+      std::vector<Execution_order::Key> keys;
+      auto count = Exec::execute(cn, batches_[k], options_, order,
+        order ? &keys : nullptr, nullptr, nullptr, parameters);
+      executed_keys.insert(cend(executed_keys), std::make_move_iterator(begin(keys)),
+        std::make_move_iterator(end(keys)));
+      std::cout << "The reference \"" << args_[k] << "\". Executed queries count = "
+                << count << ".\n";
+    }
+
+    if (is_commit_) {
+      t.commit();
+      if (order) {
+        order->update(executed_keys);
+        order->save();
+      }
+    }
   }
+#endif
+};
 
-  /// @brief Executes the SQL batches in the same transaction.
-  static std::size_t execute(pgfe::Connection* const conn,
-    const std::vector<Sql_batch>& batches)
+// =============================================================================
+
+/**
+ * @brief The `serve` command.
+ *
+ * Serves the `exec` commands forwarded by the clients (see `exec --server`)
+ * through the local socket `.pgspa/server.sock`. The requests are served one
+ * by one, by using the idle connections (one per set of the connection
+ * options) and the cache of the parsed SQL files, which are kept between the
+ * requests.
+ *
+ * @remarks The requests are not served concurrently since the output of the
+ * execution is written to the standard output and error, which are redirected
+ * to the client for the time of the request.
+ */
+class Serve final : public Command {
+public:
+  Serve()
+    : Command{"serve"}
+  {}
+
+  explicit Serve(const app::Program_parameters& params)
+    : Command{params}
   {
-    ASSERT_ALWAYS(conn);
-    ASSERT_ALWAYS(conn->is_transaction_block_uncommitted());
+    Util::check_options(params, {});
+    if (!params.arguments().empty())
+      throw std::runtime_error{"no arguments expected"};
+  }
 
-    std::size_t successes_count{};
-    std::size_t total_count = [&batches]()
-    {
-      std::size_t result{};
-      for (const auto& b : batches)
-        result += b.sql_vector()->non_empty_count();
-      return result;
-    }();
+  void run() override
+  {
+#ifndef _WIN32
+    const auto root = Util::root_path();
+    const auto path = Server_socket::path(root);
+    if (Server_socket::connect(root))
+      throw std::runtime_error{"the server is already running at \"" + path.string() + "\""};
+    filesystem::remove(path); // stale
+
+    const Server_socket listener{::socket(AF_UNIX, SOCK_STREAM, 0)};
+    const auto addr = Server_socket::address(path);
+    if (listener.fd() < 0 ||
+      ::bind(listener.fd(), reinterpret_cast<const ::sockaddr*>(&addr), sizeof(addr)) ||
+      ::listen(listener.fd(), SOMAXCONN))
+      throw std::system_error{errno, std::system_category(),
+        "cannot listen on \"" + path.string() + "\""};
+
+    // Stop serving gracefully on SIGINT and SIGTERM (accept() is interrupted).
+    static volatile std::sig_atomic_t is_stopped;
+    struct ::sigaction action{};
+    action.sa_handler = [](int) { is_stopped = 1; };
+    ::sigaction(SIGINT, &action, nullptr);
+    ::sigaction(SIGTERM, &action, nullptr);
+
+    std::cout << "Serving at \"" << path.string() << "\"..." << std::endl;
+    while (!is_stopped) {
+      if (const int fd = ::accept(listener.fd(), nullptr, nullptr); fd >= 0) {
+        Server_socket client{fd};
+        serve(client);
+      } else if (errno != EINTR && errno != ECONNABORTED)
+        throw std::system_error{errno, std::system_category(), "cannot accept connection"};
+    }
+    filesystem::remove(path);
+#else
+    throw std::runtime_error{"the command \"serve\" is not supported on Windows"};
+#endif
+  }
 
-    /*
-     * The Execution_status `es` indicates:
-     *   - if (es == std::nullopt) then the query was not yet executed;
-     *   - if (es == nullptr) then the query was executed successfully;
-     *   - if (es != nullptr) then the query was executed with a error.
-     */
-    using Execution_status = std::optional<std::unique_ptr<pgfe::Error>>;
-    auto batches_execution_statuses = [&batches]
+private:
+  Batch_cache cache_;
+  std::map<std::string, std::unique_ptr<pgfe::Connection>> connections_; // idle
+
+#ifndef _WIN32
+  /**
+   * @brief The stream buffer which sends the output to the client by frames.
+   *
+   * The output is buffered and sent when the buffer is full, at the end of
+   * each line and on flush (so the lines of the standard output and error
+   * are interleaved as they're written).
+   */
+  class Frame_buffer final : public std::streambuf {
+  public:
+    Frame_buffer(Server_socket& socket, const char channel, std::mutex& mutex)
+      : socket_{socket}
+      , channel_{channel}
+      , mutex_{mutex}
     {
-      std::vector<std::vector<Execution_status>> result;
-      for (const auto& b : batches)
-        result.emplace_back(b.sql_vector()->sql_string_count());
-      return result;
-    }();
+      setp(buffer_.data(), buffer_.data() + buffer_.size());
+    }
 
-    const auto query_position = [](const pgfe::Error* const e)
+    ~Frame_buffer() override
     {
-      std::optional<std::size_t> result;
-      if (const auto qp = e->query_position())
-        result = std::stoul(*qp);
-      return result;
-    };
+      send();
+    }
 
-    const auto report_error = [&batches, &query_position](const std::size_t i,
-      const std::size_t j, const pgfe::Error* const err)
+  protected:
+    int_type overflow(const int_type ch) override
     {
-      /// @brief Prints the Emacs-friendly information about an error to the standard error.
-      static const auto report_file_error = [](const filesystem::path& path,
-        const std::size_t lnum, const std::size_t cnum, const pgfe::Error* const err)
-      {
-        /*
-         * Use GNU style for reporting error messages:
-         * foo.sql:3:1:Error: End of file during parsing
-         * (See etc/compilation.txt of Emacs installation.)
-         */
-        std::cerr << absolute(path).string() << ":"
-                  << lnum << ":" << cnum << ":Error: " << err->brief();
-        if (const auto& d = err->detail())
-          std::cerr << "\n Detail: " << *d;
-        if (const auto& h = err->hint())
-          std::cerr << "\n Hint: " << *h;
-        if (const auto& c = err->context())
-          std::cerr << "\n Context: " << *c;
-        std::cerr << "\n";
-      };
+      send();
+      if (!traits_type::eq_int_type(ch, traits_type::eof())) {
+        *pptr() = traits_type::to_char_type(ch);
+        pbump(1);
+        if (traits_type::to_char_type(ch) == '\n')
+          send();
+      }
+      return traits_type::not_eof(ch);
+    }
 
-      ASSERT_ALWAYS(i < batches.size());
-      const auto* const sql_vector = batches[i].sql_vector();
-      ASSERT_ALWAYS(j < sql_vector->sql_string_count());
-      ASSERT_ALWAYS(!sql_vector->sql_string(j)->is_query_empty());
-      ASSERT_ALWAYS(err);
-      const auto query_offset = query_position(err);
-      if (const auto& path = batches[i].path()) {
-        const auto content = sql_vector->to_string();
-        const auto ssp = sql_vector->query_absolute_position(j);
-        const auto qpos = query_offset ?
-          ssp + *query_offset :
-          ssp + str::position_of_non_space(sql_vector->sql_string(j)->to_query_string(), 0);
-        const auto[lnum, cnum] = str::line_column_numbers_by_position(content, qpos - 1);
-        report_file_error(*path, lnum + 1, cnum + 1, err);
-      } else {
-        const auto content = sql_vector->sql_string(j)->to_string();
-        const auto qpos = query_offset.value_or(0);
-        const auto[lnum, cnum] = str::line_column_numbers_by_position(content, qpos - 1);
-        std::cerr << "pgspa internal query (see below):"
-                  << lnum + 1 << ":" << cnum + 1 << ":Error: " << err->brief() << ":\n"
-                  << content << "\n";
+    std::streamsize xsputn(const char* const s, const std::streamsize n) override
+    {
+      for (std::streamsize i{}; i < n;) {
+        if (pptr() == epptr())
+          send();
+        const auto count = std::min<std::streamsize>(n - i, epptr() - pptr());
+        traits_type::copy(pptr(), s + i, static_cast<std::size_t>(count));
+        pbump(static_cast<int>(count));
+        i += count;
       }
-    };
+      if (traits_type::find(s, static_cast<std::size_t>(n), '\n'))
+        send();
+      return n;
+    }
 
-    conn->perform("savepoint p1");
-    std::size_t iteration_successes_count{};
-    const auto batches_size = batches.size();
-    do {
-      iteration_successes_count = 0;
-      ASSERT_ALWAYS(batches_size == batches_execution_statuses.size());
-      using Counter = std::remove_const_t<decltype (batches_size)>;
-      for (Counter i = 0; i < batches_size; ++i) {
-        const auto sql_string_count = batches[i].sql_vector()->sql_string_count();
-        ASSERT_ALWAYS(sql_string_count == batches_execution_statuses[i].size());
-        using Counter = std::remove_const_t<decltype (sql_string_count)>;
-        for (Counter j = 0; j < sql_string_count; ++j) {
-          auto& execution_status = batches_execution_statuses[i][j];
-          if (!execution_status || *execution_status) {
-            const auto* const sql_string = batches[i].sql_vector()->sql_string(j);
-            if (!sql_string->is_query_empty()) {
-              try {
-                conn->execute(sql_string);
-                conn->complete();
-                execution_status = nullptr; // done
-                ++iteration_successes_count;
-                conn->perform("savepoint p1");
-              } catch (const pgfe::Server_exception& e) {
-                if (e.code() == pgfe::Server_errc::c42_duplicate_table ||
-                  e.code() == pgfe::Server_errc::c42_duplicate_function ||
-                  e.code() == pgfe::Server_errc::c42_duplicate_object ||
-                  e.code() == pgfe::Server_errc::c42_duplicate_schema) {
-                  execution_status = nullptr; // done
-                  ++iteration_successes_count;
-                  conn->perform("rollback to savepoint p1");
-                } else if (e.code() == pgfe::Server_errc::c42_undefined_table ||
-                  e.code() == pgfe::Server_errc::c42_undefined_function ||
-                  e.code() == pgfe::Server_errc::c42_undefined_object ||
-                  e.code() == pgfe::Server_errc::c3f_invalid_schema_name ||
-                  e.code() == pgfe::Server_errc::c2b_dependent_objects_still_exist) {
-                  execution_status = e.error()->to_error(); // error (hope for the next iteration)
-                  conn->perform("rollback to savepoint p1");
-                  ASSERT_ALWAYS(execution_status && *execution_status);
-                } else {
-                  execution_status = e.error()->to_error(); // fatal error (which will be reported last)
-                  goto finish;
-                }
-              }
-            } else
-              execution_status = nullptr; // done (short-circuit an empty query execution)
-          }
-        }
+    int sync() override
+    {
+      send();
+      return 0;
+    }
+
+  private:
+    Server_socket& socket_;
+    char channel_{};
+    std::mutex& mutex_;
+    std::array<char, 4096> buffer_;
+
+    void send()
+    {
+      if (const auto size = static_cast<std::size_t>(pptr() - pbase())) {
+        const std::lock_guard lg{mutex_};
+        socket_.send_frame(channel_, {pbase(), size}); // the client may be gone
+        setp(buffer_.data(), buffer_.data() + buffer_.size());
       }
-      successes_count += iteration_successes_count;
-    } while (iteration_successes_count > 0);
+    }
+  };
 
-  finish:
+  /// @brief Serves the request of the `client`.
+  void serve(Server_socket& client)
+  {
+    std::string request;
+    std::array<char, 64 * 1024> chunk;
+    try {
+      while (const auto n = client.receive(chunk.data(), chunk.size()))
+        request.append(chunk.data(), n);
+    } catch (const std::exception&) {
+      return; // the client is gone
+    }
 
-    /*
-     * If there are queries, which was not executed without errors
-     * it's necessary to report about them and to throw an exception.
-     */
-    if (successes_count < total_count) {
-      const auto batches_execution_statuses_size = batches_execution_statuses.size();
-      using Counter = std::remove_const_t<decltype (batches_execution_statuses_size)>;
-      for (Counter i = 0; i < batches_execution_statuses_size; ++i) {
-        const auto batch_execution_statuses_size = batches_execution_statuses[i].size();
-        using Counter = std::remove_const_t<decltype (batch_execution_statuses_size)>;
-        for (Counter j = 0; j < batch_execution_statuses_size; ++j) {
-          if (const auto& execution_status = batches_execution_statuses[i][j]) {
-            if (const std::unique_ptr<pgfe::Error>& e = *execution_status)
-              report_error(i, j, e.get());
-          }
+    std::vector<std::string> args{"pgspa"};
+    for (std::size_t b{}, e{}; (e = request.find('\0', b)) != std::string::npos; b = e + 1)
+      args.emplace_back(request, b, e - b);
+    std::vector<const char*> argv;
+    for (const auto& arg : args)
+      argv.push_back(arg.c_str());
+
+    // Redirect the standard output and error to the client.
+    std::mutex mutex;
+    Frame_buffer out{client, 'o', mutex}, err{client, 'e', mutex};
+    auto* const cout_buffer = std::cout.rdbuf(&out);
+    auto* const cerr_buffer = std::cerr.rdbuf(&err);
+    std::cerr.unsetf(std::ios_base::unitbuf); // flushed per line by the buffer
+    const auto exit_code = [&]
+    {
+      try {
+        const app::Program_parameters params{static_cast<int>(argv.size()), argv.data()};
+        if (params.command_name() != "exec")
+          throw std::runtime_error{"only the command \"exec\" can be served"};
+        Exec exec{params, &cache_};
+        const auto key = exec.connection_key();
+        if (const auto c = connections_.find(key); c != cend(connections_)) {
+          exec.adopt_connection(std::move(c->second));
+          connections_.erase(c);
+        }
+        const auto release = [&]
+        {
+          if (auto conn = exec.release_connection(); conn && conn->is_connected())
+            connections_[key] = std::move(conn);
+        };
+        try {
+          exec.run();
+        } catch (...) {
+          release();
+          throw;
         }
+        release();
+        return 0;
+      } catch (const Handled_exception&) {
+      } catch (const pgfe::Server_exception& e) {
+        std::cerr << "pgspa: server error: " << e.error()->brief() << "\n";
+      } catch (const std::exception& e) {
+        std::cerr << "pgspa: " << e.what() << "\n";
       }
-      throw Handled_exception{};
+      return 1;
+    }();
+    std::cout.flush();
+    std::cerr.flush();
+    std::cout.rdbuf(cout_buffer);
+    std::cerr.rdbuf(cerr_buffer);
+    std::cerr.setf(std::ios_base::unitbuf);
+    client.send_header('x', exit_code);
+  }
+#endif
+};
+
+// =============================================================================
+
+/**
+ * @brief The "bundle" command.
+ *
+ * The "bundle" command resolves the references and saves the contents of the
+ * SQL files they resolve to (along with the values of the named parameters of
+ * the queries) to the bundle, which can be executed by `pgspa exec --bundle`
+ * without the project tree.
+ */
+class Bundle final : public Command {
+public:
+  Bundle()
+    : Command{"bundle"}
+  {}
+
+  explicit Bundle(const app::Program_parameters& params)
+    : Command{params}
+    , args_{params.arguments()}
+  {
+    auto options = std::vector<std::string>{"output", "tree_index", "params_file"};
+    for (const auto& o : params.options()) {
+      if (!o.first.compare(0, parameter_prefix.size(), parameter_prefix))
+        options.push_back(o.first);
     }
+    Util::check_options(params, options);
 
-    return total_count;
+    if (const auto o = params.option_with_argument("output"))
+      output_ = *o;
+    else
+      throw std::runtime_error{"no output specified"};
+    tree_index_ = Util::boolean_option(params, "tree_index").value_or(false);
+    parameters_ = Parameters::overrides(params);
+
+    if (args_.empty())
+      throw std::runtime_error("no references specified");
+
+    ASSERT_ALWAYS(is_valid());
+  }
+
+  bool is_valid() const override
+  {
+    return !args_.empty() && !output_.empty() && Command::is_valid();
+  }
+
+  void run() override
+  {
+    const auto root = Util::root_path();
+    Project_tree tree{root, tree_index_ ?
+      std::make_optional(root / root_marker / "tree_index") : std::nullopt};
+    const auto paths = [&]
+    {
+      std::vector<filesystem::path> references;
+      references.reserve(args_.size());
+      for (const auto& arg : args_)
+        references.push_back(root / arg);
+      return tree.sql_paths(references);
+    }();
+    tree.save_index();
+
+    // The SQL files are parsed to detect the errors before deploy.
+    Parameters parameters{root, parameters_};
+    std::vector<Bundle_file::Reference> references;
+    references.reserve(args_.size());
+    std::size_t file_count{};
+    for (std::size_t k = 0; k < args_.size(); ++k) {
+      auto& reference = references.emplace_back();
+      reference.name = args_[k];
+      for (const auto& batch : Sql_batch::make_many(paths[k])) {
+        const auto& path = *batch.path();
+        if (const auto companion = batch.companion())
+          throw std::runtime_error{"cannot bundle " + path.string() + ": the data of COPY ... FROM STDIN"
+            " must be inline instead of in the file \"" + companion->string() + "\""};
+        auto content = str::file_to_string(path);
+        const auto hash = Util::hash(content);
+        reference.files.push_back({Util::project_path(path, root), std::move(content), hash,
+          parameters.values(path)});
+      }
+      file_count += reference.files.size();
+    }
+    Bundle_file{std::move(references)}.save(output_);
+    std::cout << "Bundled " << file_count << " SQL files of " << args_.size()
+              << " references to \"" << output_.string() << "\".\n";
   }
+
+private:
+  std::vector<std::string> args_;
+  filesystem::path output_;
+  bool tree_index_{};
+  Parameters::Values parameters_;
 };
 
 // =============================================================================
@@ -926,6 +7248,12 @@ std::unique_ptr<Command> Command::make(const std::string_view name, Types&& ...
     return std::make_unique<Init>(std::forward<Types>(params)...);
   else if (name == "exec")
     return std::make_unique<Exec>(std::forward<Types>(params)...);
+  else if (name == "watch")
+    return std::make_unique<Watch>(std::forward<Types>(params)...);
+  else if (name == "serve")
+    return std::make_unique<Serve>(std::forward<Types>(params)...);
+  else if (name == "bundle")
+    return std::make_unique<Bundle>(std::forward<Types>(params)...);
   else
     throw std::logic_error{"unknown command \"" + std::string{name} + "\""};
 }
@@ -941,6 +7269,7 @@ std::unique_ptr<Command> Command::make(const app::Program_parameters& params)
 
 } // namespace dmitigr:pgspa
 
+#ifndef PGSPA_NO_MAIN
 int main(const int argc, const char* const argv[])
 {
   namespace app = dmitigr::app;
@@ -982,3 +7311,4 @@ int main(const int argc, const char* const argv[])
     return 2;
   }
 }
+#endif // PGSPA_NO_MAIN
@@ -0,0 +1,431 @@
+/* -*- SQL -*-
+ * Copyright (C) Dmitry Igrishin
+ * For conditions of distribution and use, see files LICENSE.txt
+ */
+
+-- Preventing of load directly by psql(1)
+\echo Use "alter extension dmitigr_spa update to '0.2'" to load this file. \quit
+
+--------------------------------------------------------------------------------
+-- Functions for clearing schemas
+--------------------------------------------------------------------------------
+
+--------------------------------------------------------------------------------
+create or replace function spa_clear_schema_objects(schema_ name,
+    object_types_ text[] default array['rules', 'triggers', 'functions',
+      'sequences', 'views', 'domains', 'domain_constraints', 'types', 'tables'],
+    object_type out text,
+    object_identity out text,
+    dropped out boolean)
+  returns setof record
+  returns null on null input
+  language plpgsql
+as $function$
+/*
+ * Removes the following database objects: rules, triggers, functions, sequences,
+ * views, tables, indexes, domains and their constraints, composite types and enums
+ * (non-cascading).
+ *
+ * The objects and the dependencies between them (from pg_depend) are read from
+ * the catalog at once. Then the objects are dropped in layers: at first the
+ * objects on which no other objects depend, then the objects on which only the
+ * dropped objects depended, and so on. The objects of each layer are dropped by
+ * a single DROP statement per object type (or one by one, if it fails). The
+ * objects which depend on each other are dropped by a single DROP statement too.
+ *
+ * Returns: the objects and whether they are removed.
+ */
+declare
+  namespace_ oid;
+  layer_ integer := 0;
+  group_ record;
+  object_ record;
+  is_dropped_ boolean;
+begin
+  select oid into namespace_ from pg_catalog.pg_namespace where nspname = schema_;
+  if (not found) then
+    raise 'The schema % does not exists', schema_;
+  end if;
+
+  if (to_regclass('pg_temp.spa_clear_object') is null) then
+    create temporary table spa_clear_object(
+      classid oid not null,
+      objid oid not null,
+      kind text not null,
+      target text not null,
+      identity text not null,
+      layer integer,
+      is_dropped boolean,
+      primary key (classid, objid)) on commit drop;
+    create temporary table spa_clear_part(
+      classid oid not null,
+      objid oid not null,
+      holder_classid oid not null,
+      holder_objid oid not null,
+      primary key (classid, objid)) on commit drop;
+    create temporary table spa_clear_dependency(
+      classid oid not null,
+      objid oid not null,
+      refclassid oid not null,
+      refobjid oid not null) on commit drop;
+  end if;
+  truncate pg_temp.spa_clear_object, pg_temp.spa_clear_part, pg_temp.spa_clear_dependency;
+
+  /*
+   * The objects to remove. The kind is the object type of the DROP statement
+   * (or "domain constraint"), and the target is the rest of the statement.
+   */
+  insert into pg_temp.spa_clear_object(classid, objid, kind, target, identity)
+    select 'pg_catalog.pg_rewrite'::regclass, r.oid, 'rule',
+           quote_ident(r.rulename)||' on '||r.ev_class::regclass,
+           quote_ident(r.rulename)||' on '||r.ev_class::regclass
+      from pg_catalog.pg_rewrite r
+      join pg_catalog.pg_class c on (r.ev_class = c.oid)
+      where c.relnamespace = namespace_ and r.rulename <> '_RETURN' and
+            'rules' = any(object_types_)
+    union all
+    select 'pg_catalog.pg_trigger'::regclass, t.oid, 'trigger',
+           quote_ident(t.tgname)||' on '||t.tgrelid::regclass,
+           quote_ident(t.tgname)||' on '||t.tgrelid::regclass
+      from pg_catalog.pg_trigger t
+      join pg_catalog.pg_class c on (t.tgrelid = c.oid)
+      where c.relnamespace = namespace_ and not t.tgisinternal and
+            'triggers' = any(object_types_)
+    union all
+    select 'pg_catalog.pg_proc'::regclass, p.oid,
+           case
+             when exists (select 1 from pg_catalog.pg_aggregate where aggfnoid = p.oid)
+               then 'aggregate'
+             when to_jsonb(p)->>'prokind' = 'p' then 'procedure'
+             else 'function'
+           end,
+           p.oid::regprocedure::text, p.oid::regprocedure::text
+      from pg_catalog.pg_proc p
+      where p.pronamespace = namespace_ and 'functions' = any(object_types_)
+    union all
+    select 'pg_catalog.pg_class'::regclass, c.oid,
+           case c.relkind
+             when 'v' then 'view'
+             when 'S' then 'sequence'
+             when 'i' then 'index'
+             else 'table'
+           end,
+           c.oid::regclass::text, c.oid::regclass::text
+      from pg_catalog.pg_class c
+      where c.relnamespace = namespace_ and
+            ((c.relkind = 'v' and 'views' = any(object_types_)) or
+             (c.relkind = 'S' and 'sequences' = any(object_types_)) or
+             (c.relkind = 'i' and 'indexes' = any(object_types_)) or
+             (c.relkind in ('r', 'p') and c.relpersistence = 'p' and
+              'tables' = any(object_types_)))
+    union all
+    select 'pg_catalog.pg_constraint'::regclass, c.oid, 'domain constraint',
+           t.oid::regtype||' drop constraint if exists '||quote_ident(c.conname),
+           quote_ident(c.conname)||' on '||t.oid::regtype
+      from pg_catalog.pg_constraint c
+      join pg_catalog.pg_type t on (c.contypid = t.oid)
+      where t.typnamespace = namespace_ and 'domain_constraints' = any(object_types_)
+    union all
+    select 'pg_catalog.pg_type'::regclass, t.oid,
+           case t.typtype when 'd' then 'domain' else 'type' end,
+           t.oid::regtype::text, t.oid::regtype::text
+      from pg_catalog.pg_type t
+      left join pg_catalog.pg_class c on (t.typrelid = c.oid)
+      where t.typnamespace = namespace_ and
+            ((t.typtype = 'd' and 'domains' = any(object_types_)) or
+             (t.typtype in ('b', 'c', 'e', 'r') and t.typcategory <> 'A' and
+              (c.relkind = 'c' or c.relkind is null) and 'types' = any(object_types_)));
+
+  -- The parts of the other objects and the members of extensions cannot be dropped.
+  delete from pg_temp.spa_clear_object o using pg_catalog.pg_depend d
+    where d.classid = o.classid and d.objid = o.objid and d.deptype not in ('n', 'a');
+
+  /*
+   * The dependencies of the parts of the objects (like column defaults, table
+   * constraints, view rules or row types) are the dependencies of the objects.
+   */
+  insert into pg_temp.spa_clear_part
+    select 'pg_catalog.pg_rewrite'::regclass, r.oid, 'pg_catalog.pg_class'::regclass, r.ev_class
+      from pg_catalog.pg_rewrite r
+      join pg_catalog.pg_class c on (r.ev_class = c.oid)
+      where c.relnamespace = namespace_
+    union all
+    select 'pg_catalog.pg_trigger'::regclass, t.oid, 'pg_catalog.pg_class'::regclass, t.tgrelid
+      from pg_catalog.pg_trigger t
+      join pg_catalog.pg_class c on (t.tgrelid = c.oid)
+      where c.relnamespace = namespace_
+    union all
+    select 'pg_catalog.pg_constraint'::regclass, c.oid, 'pg_catalog.pg_class'::regclass, c.conrelid
+      from pg_catalog.pg_constraint c
+      join pg_catalog.pg_class r on (c.conrelid = r.oid)
+      where r.relnamespace = namespace_
+    union all
+    select 'pg_catalog.pg_constraint'::regclass, c.oid, 'pg_catalog.pg_type'::regclass, c.contypid
+      from pg_catalog.pg_constraint c
+      join pg_catalog.pg_type t on (c.contypid = t.oid)
+      where t.typnamespace = namespace_
+    union all
+    select 'pg_catalog.pg_attrdef'::regclass, a.oid, 'pg_catalog.pg_class'::regclass, a.adrelid
+      from pg_catalog.pg_attrdef a
+      join pg_catalog.pg_class c on (a.adrelid = c.oid)
+      where c.relnamespace = namespace_
+    union all
+    select 'pg_catalog.pg_class'::regclass, c.oid, 'pg_catalog.pg_type'::regclass, c.reltype
+      from pg_catalog.pg_class c
+      where c.relnamespace = namespace_ and c.relkind = 'c'
+    union all
+    select 'pg_catalog.pg_class'::regclass, i.indexrelid, 'pg_catalog.pg_class'::regclass, i.indrelid
+      from pg_catalog.pg_index i
+      join pg_catalog.pg_class c on (i.indexrelid = c.oid)
+      where c.relnamespace = namespace_
+    union all
+    select 'pg_catalog.pg_type'::regclass, t.oid, 'pg_catalog.pg_class'::regclass, t.typrelid
+      from pg_catalog.pg_type t
+      join pg_catalog.pg_class c on (t.typrelid = c.oid)
+      where t.typnamespace = namespace_ and c.relkind <> 'c'
+    union all
+    select 'pg_catalog.pg_type'::regclass, t.typarray,
+           case when c.relkind in ('r', 'p', 'v')
+             then 'pg_catalog.pg_class'::regclass else 'pg_catalog.pg_type'::regclass end,
+           case when c.relkind in ('r', 'p', 'v') then c.oid else t.oid end
+      from pg_catalog.pg_type t
+      left join pg_catalog.pg_class c on (t.typrelid = c.oid)
+      where t.typnamespace = namespace_ and t.typarray <> 0;
+  -- The objects to remove are not the parts.
+  delete from pg_temp.spa_clear_part p using pg_temp.spa_clear_object o
+    where o.classid = p.classid and o.objid = p.objid;
+
+  -- The auto dependencies never prevent from dropping of the referenced objects.
+  insert into pg_temp.spa_clear_dependency
+    select distinct o.classid, o.objid, ro.classid, ro.objid
+      from pg_catalog.pg_depend d
+      left join pg_temp.spa_clear_part p on (p.classid = d.classid and p.objid = d.objid)
+      left join pg_temp.spa_clear_part rp on (rp.classid = d.refclassid and rp.objid = d.refobjid)
+      join pg_temp.spa_clear_object o on
+        (o.classid = coalesce(p.holder_classid, d.classid) and
+         o.objid = coalesce(p.holder_objid, d.objid))
+      join pg_temp.spa_clear_object ro on
+        (ro.classid = coalesce(rp.holder_classid, d.refclassid) and
+         ro.objid = coalesce(rp.holder_objid, d.refobjid))
+      where d.deptype = 'n' and (o.classid, o.objid) <> (ro.classid, ro.objid);
+
+  loop
+    layer_ := layer_ + 1;
+
+    -- The objects on which no remaining objects depend.
+    update pg_temp.spa_clear_object o set layer = layer_
+      where o.layer is null and not exists
+        (select 1 from pg_temp.spa_clear_dependency d
+           join pg_temp.spa_clear_object x on (x.classid = d.classid and x.objid = d.objid)
+           where d.refclassid = o.classid and d.refobjid = o.objid and
+                 x.is_dropped is not true);
+    if (not found) then
+      -- The rest of the objects depend on each other (or on the objects which cannot be dropped).
+      update pg_temp.spa_clear_object set layer = layer_ where layer is null;
+      exit when not found;
+    end if;
+
+    for group_ in
+      select kind, string_agg(target, ', ') targets from pg_temp.spa_clear_object
+        where layer = layer_ group by kind
+    loop
+      if (group_.kind not in ('rule', 'trigger', 'domain constraint')) then
+        begin
+          execute 'drop '||group_.kind||' if exists '||group_.targets;
+          update pg_temp.spa_clear_object set is_dropped = true
+            where layer = layer_ and kind = group_.kind;
+          continue;
+        exception
+          when dependent_objects_still_exist or wrong_object_type or feature_not_supported then
+            null; -- fall back to dropping one by one
+        end;
+      end if;
+
+      for object_ in
+        select classid, objid, target from pg_temp.spa_clear_object
+          where layer = layer_ and kind = group_.kind
+      loop
+        begin
+          if (group_.kind = 'domain constraint') then
+            execute 'alter domain '||object_.target;
+          else
+            execute 'drop '||group_.kind||' if exists '||object_.target;
+          end if;
+          is_dropped_ := true;
+        exception
+          when dependent_objects_still_exist or wrong_object_type or feature_not_supported or
+               undefined_object or undefined_table or undefined_function then
+            is_dropped_ := false;
+        end;
+        update pg_temp.spa_clear_object set is_dropped = is_dropped_
+          where classid = object_.classid and objid = object_.objid;
+      end loop;
+    end loop;
+  end loop;
+
+  -- The objects which are dropped along with the other objects.
+  update pg_temp.spa_clear_object set is_dropped = true
+    where is_dropped is not true and not
+      case classid
+        when 'pg_catalog.pg_rewrite'::regclass then
+          exists (select 1 from pg_catalog.pg_rewrite where oid = objid)
+        when 'pg_catalog.pg_trigger'::regclass then
+          exists (select 1 from pg_catalog.pg_trigger where oid = objid)
+        when 'pg_catalog.pg_proc'::regclass then
+          exists (select 1 from pg_catalog.pg_proc where oid = objid)
+        when 'pg_catalog.pg_class'::regclass then
+          exists (select 1 from pg_catalog.pg_class where oid = objid)
+        when 'pg_catalog.pg_constraint'::regclass then
+          exists (select 1 from pg_catalog.pg_constraint where oid = objid)
+        else
+          exists (select 1 from pg_catalog.pg_type where oid = objid)
+      end;
+
+  return query select kind, identity, coalesce(is_dropped, false)
+    from pg_temp.spa_clear_object order by layer, kind, identity;
+end;
+$function$;
+comment on function spa_clear_schema_objects(name, text[], out text, out text, out boolean) is
+  'Drops the objects of the given schema in order of dependencies and returns them';
+--------------------------------------------------------------------------------
+
+--------------------------------------------------------------------------------
+create or replace function spa_clear_schema(schema_ name,
+    object_types_ text[] default array['rules', 'triggers', 'functions',
+      'sequences', 'views', 'domains', 'domain_constraints', 'types', 'tables'],
+    verbose_ boolean default true,
+    out deleted_count integer,
+    out remains_count integer)
+  returns null on null input
+  language plpgsql
+as $function$
+/*
+ * Removes the objects of the given schema by using spa_clear_schema_objects().
+ *
+ * Returns: the count of removed and remaining objects.
+ */
+declare
+  remains_ text;
+begin
+  select count(*) filter (where dropped), count(*) filter (where not dropped),
+         string_agg(object_type||' '||object_identity, ', ') filter (where not dropped)
+    into deleted_count, remains_count, remains_
+    from @extschema@.spa_clear_schema_objects(schema_, object_types_);
+
+  if (verbose_) then
+    raise notice 'The % objects of the schema % have been removed', deleted_count, schema_;
+    if (remains_count > 0) then
+      raise notice 'The objects of the schema % were not removed: %', schema_, remains_;
+    end if;
+  end if;
+end;
+$function$;
+comment on function spa_clear_schema(name, text[], boolean) is 'Drops the objects of the given schema';
+--------------------------------------------------------------------------------
+
+--------------------------------------------------------------------------------
+-- Deploy ledger
+--------------------------------------------------------------------------------
+
+--------------------------------------------------------------------------------
+create table spa_ledger(
+  path text not null primary key,
+  hash text not null,
+  deployed_at timestamp with time zone not null default now()
+);
+comment on table spa_ledger is
+  'The hashes of the contents of the SQL files deployed by pgspa';
+comment on column spa_ledger.path is
+  'The path of the SQL file relative to the project directory';
+comment on column spa_ledger.hash is
+  'The hash of the content of the SQL file';
+comment on column spa_ledger.deployed_at is
+  'The time of the last deploy of the SQL file';
+select pg_catalog.pg_extension_config_dump('spa_ledger', '');
+--------------------------------------------------------------------------------
+
+--------------------------------------------------------------------------------
+-- Server-side execution
+--------------------------------------------------------------------------------
+
+--------------------------------------------------------------------------------
+create or replace function spa_exec(statements_ text[],
+    statement_index out integer,
+    is_done out boolean,
+    execution_number out integer,
+    attempt_count out integer,
+    error_sqlstate out text,
+    error_message out text)
+  returns setof record
+  returns null on null input
+  language plpgsql
+as $function$
+/*
+ * Executes the statements iteratively in the current transaction. Each
+ * statement is executed in its own subtransaction. The statements which are
+ * failed with the ignorable errors (42723, 42P06, 42P07, 42710) are considered
+ * done. The statements which are failed with the non-fatal errors (2BP01,
+ * 3F000, 42883, 42P01, 42704) are executed again at the next iteration. The
+ * execution stops when either all of the statements are done, or none of them
+ * succeeded during the iteration, or a statement failed with any other error.
+ *
+ * Returns: the row per statement (identified by its index in `statements_`)
+ * with the number in order of execution of the statement which is done, the
+ * count of attempts to execute it and the last error of the statement which is
+ * not done.
+ */
+declare
+  count_ integer := coalesce(array_length(statements_, 1), 0);
+  is_done_ boolean[] := array_fill(false, array[count_]);
+  execution_numbers_ integer[] := array_fill(null::integer, array[count_]);
+  attempt_counts_ integer[] := array_fill(0, array[count_]);
+  sqlstates_ text[] := array_fill(null::text, array[count_]);
+  messages_ text[] := array_fill(null::text, array[count_]);
+  done_count_ integer := 0;
+  iteration_done_count_ integer;
+  is_fatal_ boolean := false;
+  sqlstate_ text;
+  message_ text;
+begin
+  while (done_count_ < count_ and not is_fatal_) loop
+    iteration_done_count_ := 0;
+    for i in 1..count_ loop
+      continue when is_done_[i];
+
+      attempt_counts_[i] := attempt_counts_[i] + 1;
+      begin
+        execute statements_[i];
+        sqlstate_ := null;
+      exception
+        when others then
+          get stacked diagnostics sqlstate_ = returned_sqlstate, message_ = message_text;
+      end;
+
+      if (sqlstate_ is null or sqlstate_ in ('42723', '42P06', '42P07', '42710')) then
+        done_count_ := done_count_ + 1;
+        iteration_done_count_ := iteration_done_count_ + 1;
+        is_done_[i] := true;
+        execution_numbers_[i] := done_count_;
+        sqlstates_[i] := null;
+        messages_[i] := null;
+      else
+        sqlstates_[i] := sqlstate_;
+        messages_[i] := message_;
+        if (sqlstate_ not in ('2BP01', '3F000', '42883', '42P01', '42704')) then
+          is_fatal_ := true;
+          exit;
+        end if;
+      end if;
+    end loop;
+
+    exit when iteration_done_count_ = 0;
+  end loop;
+
+  return query select s.i, is_done_[s.i], execution_numbers_[s.i],
+      attempt_counts_[s.i], sqlstates_[s.i], messages_[s.i]
+    from generate_series(1, count_) as s(i);
+end;
+$function$;
+comment on function spa_exec(text[]) is
+  'Executes the statements iteratively within the server';
+--------------------------------------------------------------------------------